@@ -0,0 +1,58 @@
+// 协程局部存储微基准: FiberLocal::get() 与 按(协程id, key)查哈希表 的单次访问耗时
+#include "fiber_local.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <unordered_map>
+
+using namespace sylar;
+
+static const uint64_t kRounds = 100000000;
+
+static FiberLocal<uint64_t> s_trace_id;
+
+// 对照组: 以协程id为key的哈希表
+static std::unordered_map<uint64_t, uint64_t> s_trace_map;
+
+template<class F>
+static double Measure(uint64_t rounds, F f)
+{
+	uint64_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(uint64_t i=0;i<rounds;i++)
+	{
+		sum += f();
+		// 阻止编译器把循环中的访问提到循环外
+		asm volatile("" : "+r"(sum) :: "memory");
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : kRounds;
+
+	Fiber::GetThis();
+
+	Fiber::ptr fiber(new Fiber([rounds]()
+	{
+		uint64_t id = Fiber::GetFiberId();
+		s_trace_id.set(id);
+		// 模拟其他协程的数据
+		for(uint64_t i=0;i<1000;i++)
+		{
+			s_trace_map[id + 1 + i] = i;
+		}
+		s_trace_map[id] = id;
+
+		double local_ns = Measure(rounds, []() {return *s_trace_id.get();});
+		double map_ns = Measure(rounds, []() {return s_trace_map.find(Fiber::GetFiberId())->second;});
+
+		std::cout << "rounds: " << rounds
+				  << ", FiberLocal ns/get: " << local_ns
+				  << ", unordered_map ns/get: " << map_ns << std::endl;
+	}, 0, false));
+	fiber->resume();
+	return 0;
+}
@@ -0,0 +1,62 @@
+// 协程交接微基准: 两个协程轮流唤醒对方
+// schedule: 唤醒方scheduleLock()对方后yield() -> 经过全局锁/任务队列/调度协程
+// handoff:  唤醒方Scheduler::handoff()对方    -> 直接切换
+#include "scheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace sylar;
+
+static const uint64_t kRounds = 1000000;
+
+static Fiber::ptr s_ping;
+static Fiber::ptr s_pong;
+
+static void PingPong(uint64_t rounds, bool handoff, bool ping)
+{
+	Scheduler* sc = Scheduler::GetThis();
+	for(uint64_t i=0;i<rounds;i++)
+	{
+		const Fiber::ptr& other = ping ? s_pong : s_ping;
+		if(handoff)
+		{
+			sc->handoff(other);
+		}
+		else
+		{
+			sc->scheduleLock(other);
+			Fiber::Current()->yield();
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	bool handoff = argc > 1 && strcmp(argv[1], "handoff") == 0;
+	uint64_t rounds = argc > 2 ? strtoull(argv[2], nullptr, 10) : kRounds;
+
+	std::chrono::steady_clock::time_point start;
+	{
+		// 单线程 -> 只比较切换路径
+		Scheduler sc(1, true, "bench");
+		s_ping.reset(new Fiber([=]() {PingPong(rounds, handoff, true);}));
+		s_pong.reset(new Fiber([=]() {PingPong(rounds, handoff, false);}));
+
+		start = std::chrono::steady_clock::now();
+		sc.scheduleLock(s_ping);
+		sc.start();
+		sc.stop();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	std::cout << (handoff ? "handoff" : "schedule") 
+			  << ", rounds: " << rounds 
+			  << ", ns/wakeup: " << ns / (rounds * 2) << std::endl;
+
+	s_ping.reset();
+	s_pong.reset();
+	return 0;
+}
@@ -0,0 +1,67 @@
+// 循环timer错过周期时的行为: FIXED_DELAY / FIXED_RATE_SKIP / FIXED_RATE_COALESCE / FIXED_RATE_BURST
+// 周期10ms 每1ms处理一次超时 第25ms时处理线程卡住35ms(错过3个周期) 共运行100ms
+// 输出每次触发的时间(相对开始的毫秒数) 触发次数 和最后一次触发相对周期网格的偏移
+#include "timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sylar;
+
+static const int kPeriodMs = 10;
+static const int kStallAtMs = 25;
+static const int kStallMs = 35;
+static const int kRunMs = 100;
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Run(const char* name, Timer::Recurrence recurrence)
+{
+	TimerManager manager;
+	std::vector<double> fires;
+	auto start = std::chrono::steady_clock::now();
+	auto timer = manager.addRecurringTimer(std::chrono::milliseconds(kPeriodMs), [&fires, start]() {fires.push_back(MsSince(start));}, recurrence);
+
+	bool stalled = false;
+	while(MsSince(start) < kRunMs)
+	{
+		std::vector<Callback> cbs;
+		manager.listExpiredCb(cbs);
+		for(auto& cb : cbs)
+		{
+			cb();
+		}
+		if(!stalled && MsSince(start) >= kStallAtMs)
+		{
+			stalled = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(kStallMs));
+			continue;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	timer->cancel();
+
+	printf("%-20s fires: %2zu, at:", name, fires.size());
+	for(double t : fires)
+	{
+		printf(" %.1f", t);
+	}
+	double offset = fires.empty() ? 0 : fires.back() - (int)(fires.back() / kPeriodMs) * kPeriodMs;
+	printf(", last offset from grid: %.1fms\n", offset);
+}
+
+int main()
+{
+	// 预期: delay在卡住之后偏离网格; skip停在网格上并跳过错过的周期; coalesce补发一次后从那时重新计算网格;
+	// burst在卡住结束后连续补发错过的周期 总次数与周期数相同
+	Run("FIXED_DELAY", Timer::FIXED_DELAY);
+	Run("FIXED_RATE_SKIP", Timer::FIXED_RATE_SKIP);
+	Run("FIXED_RATE_COALESCE", Timer::FIXED_RATE_COALESCE);
+	Run("FIXED_RATE_BURST", Timer::FIXED_RATE_BURST);
+	return 0;
+}
@@ -0,0 +1,77 @@
+// 调度器吞吐量基准: 不同工作线程数下每秒完成的任务数
+// spawn:  每个根任务在工作线程中再提交一批子任务 -> 本地队列 + 窃取
+// submit: 所有任务由外部线程(主线程)提交 -> 全局队列
+#include "ioscheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace sylar;
+
+static const uint64_t kTasks  = 1000000;
+static const uint64_t kFanout = 100;
+
+static std::atomic<uint64_t> s_done{0};
+
+static void Work()
+{
+	s_done.fetch_add(1, std::memory_order_relaxed);
+}
+
+static double Run(size_t threads, bool spawn, uint64_t tasks)
+{
+	s_done = 0;
+	// use_caller -> 主线程只在stop()时参与调度 -> 计时期间有threads个工作线程
+	IOManager iom(threads + 1, true, "bench");
+
+	auto start = std::chrono::steady_clock::now();
+	if(spawn)
+	{
+		for(uint64_t i=0;i<tasks/kFanout;i++)
+		{
+			iom.scheduleLock([]()
+			{
+				Scheduler* sc = Scheduler::GetThis();
+				for(uint64_t j=0;j<kFanout;j++)
+				{
+					sc->scheduleLock(&Work);
+				}
+			});
+		}
+	}
+	else
+	{
+		for(uint64_t i=0;i<tasks;i++)
+		{
+			iom.scheduleLock(&Work);
+		}
+	}
+
+	// 不能用sleep -> 主线程参与过上一轮调度后hook仍处于开启状态
+	while(s_done.load(std::memory_order_relaxed) < tasks)
+	{
+		std::this_thread::yield();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return tasks / std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+	bool spawn = !(argc > 1 && strcmp(argv[1], "submit") == 0);
+	uint64_t tasks = argc > 2 ? strtoull(argv[2], nullptr, 10) : kTasks;
+	tasks = tasks / kFanout * kFanout;
+
+	for(size_t threads : {1, 2, 4, 8, 16, 32, 64})
+	{
+		double rate = Run(threads, spawn, tasks);
+		std::cout << (spawn ? "spawn" : "submit") 
+				  << ", threads: " << threads 
+				  << ", tasks/s: " << (uint64_t)rate << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+// 挂起连接的内存占用: 模拟大量阻塞在读操作上的连接协程 统计每个挂起协程占用的RSS
+// 用法: ./shared_stack_bench [dedicated|mmap|shared] [连接数]
+#include "fiber.h"
+#include "stack_allocator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+using namespace sylar;
+
+// 当前进程的RSS(字节)
+static size_t rss_bytes()
+{
+	size_t pages = 0, resident = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if(f)
+	{
+		if(fscanf(f, "%zu %zu", &pages, &resident) != 2)
+		{
+			resident = 0;
+		}
+		fclose(f);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 与main.cpp中的连接处理函数类似: 1K的接收缓冲区 然后挂起等待数据
+static void __attribute__((noinline)) park_connection()
+{
+	char buffer[1024];
+	memset(buffer, 0, sizeof(buffer));
+	Fiber::Current()->yield();
+	asm volatile("" : : "r"(buffer) : "memory");
+}
+
+int main(int argc, char *argv[])
+{
+	const char* mode = argc > 1 ? argv[1] : "shared";
+	size_t count = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000;
+
+	Fiber::GetThis();
+
+	std::vector<Fiber::ptr> fibers;
+	fibers.reserve(count);
+
+	size_t before = rss_bytes();
+	for(size_t i=0;i<count;i++)
+	{
+		Fiber::ptr fiber;
+		if(strcmp(mode, "shared") == 0)
+		{
+			fiber.reset(new Fiber(&park_connection, 0, false, nullptr, true));
+		}
+		else if(strcmp(mode, "mmap") == 0)
+		{
+			fiber.reset(new Fiber(&park_connection, 0, false, MmapStackAllocator::GetInstance()));
+		}
+		else
+		{
+			fiber.reset(new Fiber(&park_connection, 0, false));
+		}
+		fiber->resume();
+		fibers.push_back(fiber);
+	}
+	size_t after = rss_bytes();
+
+	printf("mode: %s, connections: %zu, rss: %.1f MB, per connection: %.2f KB\n", 
+		mode, count, (after - before) / 1048576.0, (after - before) / 1024.0 / count);
+
+	// 唤醒所有连接 让协程正常结束
+	for(auto& fiber : fibers)
+	{
+		fiber->resume();
+	}
+	return 0;
+}
@@ -0,0 +1,41 @@
+// 协程切换微基准: 主协程与子协程之间来回切换 统计每次切换的耗时
+#include "fiber.h"
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace sylar;
+
+static const uint64_t kRounds = 10000000;
+
+int main(int argc, char *argv[])
+{
+	uint64_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : kRounds;
+
+	// 初始化当前线程的主协程
+	Fiber::GetThis();
+
+	Fiber::ptr fiber(new Fiber([rounds]()
+	{
+		for(uint64_t i=0;i<rounds;i++)
+		{
+			Fiber::Current()->yield();
+		}
+	}, 0, false));
+
+	auto start = std::chrono::steady_clock::now();
+	for(uint64_t i=0;i<rounds;i++)
+	{
+		fiber->resume();
+	}
+	auto end = std::chrono::steady_clock::now();
+	// 让协程函数运行结束
+	fiber->resume();
+
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	// 一次resume + 一次yield = 两次切换
+	std::cout << "backend: " << context_backend() 
+			  << ", rounds: " << rounds 
+			  << ", ns/switch: " << ns / (rounds * 2) << std::endl;
+	return 0;
+}
@@ -0,0 +1,111 @@
+// 无栈协程(Task)基准 -> 需要 -std=c++20
+// spawn:  Spawn()n个无栈协程 每个co_await一个子任务 -> 与fiber(调度n个有栈协程回调)比较每个任务的开销
+// blockon: 有栈协程中反复BlockOn()一个无栈协程 -> 每次等待的往返耗时
+// pipe:   两个无栈协程通过两个管道轮流唤醒对方(EventAwaiter) -> 每次IO唤醒的耗时
+#include "task.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace sylar;
+
+static const uint64_t kCount = 100000;
+
+static std::atomic<uint64_t> s_sum{0};
+
+static Task<uint64_t> Child(uint64_t i)
+{
+	co_return i + 1;
+}
+
+static Task<> Parent(uint64_t i)
+{
+	s_sum += co_await Child(i);
+}
+
+// 先写再等待对方的回复 -> 只有ping先写
+static Task<> PingPong(int rfd, int wfd, uint64_t rounds, bool ping)
+{
+	char c = 'x';
+	for(uint64_t i=0;i<rounds;i++)
+	{
+		if(ping)
+		{
+			write(wfd, &c, 1);
+		}
+		if(co_await Readable(rfd) != 0)
+		{
+			std::cerr << "Readable() failed" << std::endl;
+			co_return;
+		}
+		read(rfd, &c, 1);
+		if(!ping)
+		{
+			write(wfd, &c, 1);
+		}
+	}
+	s_sum += rounds;
+}
+
+int main(int argc, char *argv[])
+{
+	const char* mode = argc > 1 ? argv[1] : "spawn";
+	uint64_t n = argc > 2 ? strtoull(argv[2], nullptr, 10) : kCount;
+
+	std::chrono::steady_clock::time_point start;
+	{
+		IOManager iom(strcmp(mode, "spawn") == 0 || strcmp(mode, "fiber") == 0 ? 4 : 1, true, "bench");
+		start = std::chrono::steady_clock::now();
+		if(strcmp(mode, "spawn") == 0)
+		{
+			for(uint64_t i=0;i<n;i++)
+			{
+				Spawn(&iom, Parent(i));
+			}
+		}
+		else if(strcmp(mode, "fiber") == 0)
+		{
+			for(uint64_t i=0;i<n;i++)
+			{
+				iom.scheduleLock([i]() {s_sum += i + 1;});
+			}
+		}
+		else if(strcmp(mode, "blockon") == 0)
+		{
+			iom.scheduleLock([n]()
+			{
+				for(uint64_t i=0;i<n;i++)
+				{
+					s_sum += BlockOn(Child(i));
+				}
+			});
+		}
+		else
+		{
+			int a[2], b[2];
+			if(pipe2(a, O_NONBLOCK) || pipe2(b, O_NONBLOCK))
+			{
+				std::cerr << "pipe2() failed" << std::endl;
+				return 1;
+			}
+			Spawn(&iom, PingPong(b[0], a[1], n, true));
+			Spawn(&iom, PingPong(a[0], b[1], n, false));
+		}
+		iom.stop();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	// spawn/fiber/blockon: 1+2+...+n -> pipe: 2n
+	bool pipe_mode = strcmp(mode, "pipe") == 0;
+	uint64_t expected = pipe_mode ? 2 * n : n * (n + 1) / 2;
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	std::cout << "mode: " << mode
+			  << ", count: " << n
+			  << ", ns/" << (pipe_mode ? "wakeup: " : "task: ") << ns / (pipe_mode ? 2 * n : n)
+			  << (s_sum == expected ? "" : ", WRONG RESULT") << std::endl;
+	return 0;
+}
@@ -0,0 +1,56 @@
+// 全局任务队列基准: 先由外部线程提交N个任务 再由调度器全部取出执行
+// 分别统计提交和取出执行的耗时
+// 第二个参数为批量大小 -> 不为0时每次用scheduleBatch()提交一批
+#include "scheduler.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+using namespace sylar;
+
+static const uint64_t kTasks = 1000000;
+
+static uint64_t s_done = 0;
+
+static void Work()
+{
+	s_done++;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t tasks = argc > 1 ? strtoull(argv[1], nullptr, 10) : kTasks;
+	uint64_t batch = argc > 2 ? strtoull(argv[2], nullptr, 10) : 0;
+	std::vector<Callback> cbs;
+
+	// 只使用主线程 -> stop()之前不会取出任务
+	Scheduler sc(1, true, "bench");
+	sc.start();
+
+	auto start = std::chrono::steady_clock::now();
+	for(uint64_t i=0;i<tasks;i++)
+	{
+		if(batch == 0)
+		{
+			sc.scheduleLock(&Work);
+			continue;
+		}
+		cbs.push_back(&Work);
+		if(cbs.size() == batch || i + 1 == tasks)
+		{
+			sc.scheduleBatch(cbs.begin(), cbs.end());
+			cbs.clear();
+		}
+	}
+	auto queued = std::chrono::steady_clock::now();
+	sc.stop();
+	auto end = std::chrono::steady_clock::now();
+
+	double push_ns  = std::chrono::duration<double, std::nano>(queued - start).count() / tasks;
+	double drain_ns = std::chrono::duration<double, std::nano>(end - queued).count() / tasks;
+	std::cout << "tasks: " << tasks << ", batch: " << batch << ", done: " << s_done
+			  << ", ns/push: " << push_ns 
+			  << ", ns/drain: " << drain_ns << std::endl;
+	return 0;
+}
@@ -0,0 +1,112 @@
+// 定时器基准: std::set / 时间轮
+// 先加入N个超时时间随机(1ms~60s)的常驻timer 再在此基础上反复加入并取消timer(类似hook中带超时的读写)
+// 最后加入N个立即超时的timer并全部取出
+// 分别统计加入/加入并取消/取消/取出的耗时
+// 第三个参数为加入并取消的线程数 第四个参数为分片数(默认与线程数相同 为1时所有线程竞争同一把锁)
+#include "timer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace sylar;
+
+static const uint64_t kTimers = 100000;
+static const uint64_t kChurn = 1000000;
+
+static std::atomic<uint64_t> s_done{0};
+
+static thread_local size_t t_shard = 0;
+
+// 每个线程使用自己的分片
+class ShardedTimerManager : public TimerManager
+{
+public:
+	ShardedTimerManager(Backend backend, size_t shards): TimerManager(backend, shards) {}
+
+protected:
+	size_t getShard() override {return t_shard;}
+};
+
+static void Work()
+{
+	s_done++;
+}
+
+static double NsPer(std::chrono::steady_clock::time_point start, uint64_t n)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+int main(int argc, char *argv[])
+{
+	TimerManager::Backend backend = argc > 1 && strcmp(argv[1], "set") == 0 ? TimerManager::SET : TimerManager::WHEEL;
+	uint64_t timers = argc > 2 ? strtoull(argv[2], nullptr, 10) : kTimers;
+	uint64_t threads = argc > 3 ? strtoull(argv[3], nullptr, 10) : 1;
+	uint64_t shards = argc > 4 ? strtoull(argv[4], nullptr, 10) : threads;
+
+	ShardedTimerManager manager(backend, shards);
+	std::mt19937 rng(1);
+	std::vector<std::shared_ptr<Timer>> standing;
+	standing.reserve(timers);
+
+	auto start = std::chrono::steady_clock::now();
+	for(uint64_t i=0;i<timers;i++)
+	{
+		standing.push_back(manager.addTimer(1 + rng() % 60000, &Work));
+	}
+	double add_ns = NsPer(start, timers);
+
+	std::vector<std::thread> workers;
+	start = std::chrono::steady_clock::now();
+	for(uint64_t t=0;t<threads;t++)
+	{
+		workers.emplace_back([&manager, t, threads]()
+		{
+			t_shard = t;
+			for(uint64_t i=0;i<kChurn/threads;i++)
+			{
+				manager.addTimer(1000 + i % 5000, &Work)->cancel();
+			}
+		});
+	}
+	for(auto& worker : workers)
+	{
+		worker.join();
+	}
+	double churn_ns = NsPer(start, kChurn);
+
+	start = std::chrono::steady_clock::now();
+	for(auto& timer : standing)
+	{
+		timer->cancel();
+	}
+	double cancel_ns = NsPer(start, timers);
+	standing.clear();
+
+	for(uint64_t i=0;i<timers;i++)
+	{
+		manager.addTimer(0, &Work);
+	}
+	std::vector<Callback> cbs;
+	start = std::chrono::steady_clock::now();
+	manager.listExpiredCb(cbs);
+	double expire_ns = NsPer(start, timers);
+	for(auto& cb : cbs)
+	{
+		cb();
+	}
+
+	std::cout << (backend == TimerManager::SET ? "set" : "wheel") << ", timers: " << timers 
+			  << ", threads: " << threads << ", shards: " << shards << ", fired: " << s_done
+			  << ", ns/add: " << add_ns
+			  << ", ns/add+cancel: " << churn_ns
+			  << ", ns/cancel: " << cancel_ns
+			  << ", ns/expire: " << expire_ns << std::endl;
+	return 0;
+}
@@ -0,0 +1,58 @@
+// 空闲线程唤醒延迟基准: 工作线程空闲(自旋后挂起)时 由外部线程提交一个任务 统计从提交到任务开始运行的时间
+// 参数为空闲自旋次数(Scheduler::setIdleSpin) -> 0表示直接挂起
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace sylar;
+
+static const int kRounds = 2000;
+
+static std::atomic<int64_t> s_started{0};
+
+static int64_t Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t spins = argc > 1 ? strtoul(argv[1], nullptr, 10) : Scheduler::kDefaultIdleSpin;
+
+	// use_caller -> 主线程只在stop()时参与调度 -> 计时期间只有一个工作线程
+	Scheduler sc(2, true, "bench");
+	sc.setIdleSpin(spins);
+	sc.start();
+
+	std::vector<int64_t> lat;
+	std::thread submitter([&]()
+	{
+		for(int i=0;i<kRounds;i++)
+		{
+			// 等工作线程自旋结束并挂起
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+			s_started = 0;
+			int64_t submit = Now();
+			sc.scheduleLock([]() {s_started = Now();});
+			while(s_started == 0)
+			{
+				std::this_thread::yield();
+			}
+			lat.push_back(s_started - submit);
+		}
+	});
+	submitter.join();
+	sc.stop();
+
+	std::sort(lat.begin(), lat.end());
+	std::cout << "spins: " << spins 
+			  << ", wake latency p50: " << lat[lat.size() / 2] / 1000.0 << "us"
+			  << ", p99: " << lat[lat.size() * 99 / 100] / 1000.0 << "us" << std::endl;
+	return 0;
+}
@@ -0,0 +1,210 @@
+#include "context.h"
+
+#include <cstdint>
+
+#ifdef SYLAR_ASM_CONTEXT
+
+extern "C" {
+	// 新协程首次被切换进入时的入口 -> 调用保存在callee-saved寄存器中的协程函数
+	void sylar_context_entry();
+}
+
+#if defined(__x86_64__)
+
+// 栈布局(低地址 -> 高地址): mxcsr|x87控制字, r15, r14, r13, r12, rbx, rbp, 返回地址
+asm(R"(
+	.text
+	.globl sylar_swap_context
+	.type sylar_swap_context, @function
+	.p2align 4
+sylar_swap_context:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $8, %rsp
+	stmxcsr (%rsp)
+	fnstcw 4(%rsp)
+
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+
+	ldmxcsr (%rsp)
+	fldcw 4(%rsp)
+	addq $8, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size sylar_swap_context, .-sylar_swap_context
+
+	.globl sylar_context_entry
+	.type sylar_context_entry, @function
+	.p2align 4
+sylar_context_entry:
+	callq *%r12
+	ud2
+	.size sylar_context_entry, .-sylar_context_entry
+
+	.section .note.GNU-stack,"",@progbits
+	.text
+)");
+
+namespace {
+const size_t kFrameWords = 8;
+const size_t kFnSlot     = 4; // r12
+const size_t kRetSlot    = 7;
+}
+
+static void init_frame(uint64_t* frame)
+{
+	uint32_t mxcsr;
+	uint16_t fcw;
+	asm volatile("stmxcsr %0" : "=m"(mxcsr));
+	asm volatile("fnstcw %0" : "=m"(fcw));
+	frame[0] = (uint64_t)mxcsr | ((uint64_t)fcw << 32);
+}
+
+#elif defined(__aarch64__)
+
+// 栈布局(低地址 -> 高地址): x19-x28, x29, x30, d8-d15, fpcr, 填充
+asm(R"(
+	.text
+	.globl sylar_swap_context
+	.type sylar_swap_context, %function
+	.p2align 4
+sylar_swap_context:
+	sub sp, sp, #176
+	stp x19, x20, [sp, #0]
+	stp x21, x22, [sp, #16]
+	stp x23, x24, [sp, #32]
+	stp x25, x26, [sp, #48]
+	stp x27, x28, [sp, #64]
+	stp x29, x30, [sp, #80]
+	stp d8,  d9,  [sp, #96]
+	stp d10, d11, [sp, #112]
+	stp d12, d13, [sp, #128]
+	stp d14, d15, [sp, #144]
+	mrs x9, fpcr
+	str x9, [sp, #160]
+
+	mov x9, sp
+	str x9, [x0]
+	mov sp, x1
+
+	ldp x19, x20, [sp, #0]
+	ldp x21, x22, [sp, #16]
+	ldp x23, x24, [sp, #32]
+	ldp x25, x26, [sp, #48]
+	ldp x27, x28, [sp, #64]
+	ldp x29, x30, [sp, #80]
+	ldp d8,  d9,  [sp, #96]
+	ldp d10, d11, [sp, #112]
+	ldp d12, d13, [sp, #128]
+	ldp d14, d15, [sp, #144]
+	ldr x9, [sp, #160]
+	msr fpcr, x9
+	add sp, sp, #176
+	ret
+	.size sylar_swap_context, .-sylar_swap_context
+
+	.globl sylar_context_entry
+	.type sylar_context_entry, %function
+	.p2align 4
+sylar_context_entry:
+	blr x19
+	brk #0
+	.size sylar_context_entry, .-sylar_context_entry
+
+	.section .note.GNU-stack,"",%progbits
+	.text
+)");
+
+namespace {
+const size_t kFrameWords = 22;
+const size_t kFnSlot     = 0;  // x19
+const size_t kRetSlot    = 11; // x30
+}
+
+static void init_frame(uint64_t* frame)
+{
+	uint64_t fpcr;
+	asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+	frame[20] = fpcr;
+}
+
+#endif
+
+namespace sylar {
+
+int init_context(Context* ctx)
+{
+	// 主协程的寄存器在第一次切出时保存
+	ctx->sp = nullptr;
+	return 0;
+}
+
+int make_context(Context* ctx, void* stack, size_t size, void (*fn)())
+{
+	// 栈顶按16字节对齐 -> 入口处call之前满足ABI要求
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+	uint64_t* frame = (uint64_t*)(top - kFrameWords * sizeof(uint64_t));
+
+	for(size_t i=0;i<kFrameWords;i++)
+	{
+		frame[i] = 0;
+	}
+	init_frame(frame);
+	frame[kFnSlot]  = (uint64_t)fn;
+	frame[kRetSlot] = (uint64_t)&sylar_context_entry;
+
+	ctx->sp = frame;
+	return 0;
+}
+
+const char* context_backend()
+{
+#if defined(__x86_64__)
+	return "asm-x86_64";
+#else
+	return "asm-aarch64";
+#endif
+}
+
+}
+
+#else // ucontext
+
+namespace sylar {
+
+int init_context(Context* ctx)
+{
+	return getcontext(&ctx->uc);
+}
+
+int make_context(Context* ctx, void* stack, size_t size, void (*fn)())
+{
+	if(getcontext(&ctx->uc))
+	{
+		return -1;
+	}
+	ctx->uc.uc_link = nullptr;
+	ctx->uc.uc_stack.ss_sp = stack;
+	ctx->uc.uc_stack.ss_size = size;
+	makecontext(&ctx->uc, fn, 0);
+	return 0;
+}
+
+const char* context_backend()
+{
+	return "ucontext";
+}
+
+}
+
+#endif
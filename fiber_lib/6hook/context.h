@@ -0,0 +1,70 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <cstddef>
+#include <ucontext.h>
+
+// 上下文切换后端
+// x86-64 / aarch64 默认使用汇编实现 只保存callee-saved寄存器和浮点控制字 不做rt_sigprocmask系统调用
+// 编译时定义 SYLAR_USE_UCONTEXT 则退回到ucontext实现
+#if !defined(SYLAR_USE_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#define SYLAR_ASM_CONTEXT 1
+#endif
+
+#ifdef SYLAR_ASM_CONTEXT
+extern "C" {
+	// 保存当前寄存器到*from_sp指向的栈上 并切换到to_sp
+	void sylar_swap_context(void** from_sp, void* to_sp);
+}
+#endif
+
+namespace sylar {
+
+// 协程上下文
+struct Context
+{
+#ifdef SYLAR_ASM_CONTEXT
+	// 切出时的栈顶 寄存器保存在栈上
+	void* sp = nullptr;
+#else
+	ucontext_t uc;
+#endif
+};
+
+// 初始化主协程的上下文
+int init_context(Context* ctx);
+
+// 在[stack, stack+size)上构造上下文 首次切换进入时执行fn
+int make_context(Context* ctx, void* stack, size_t size, void (*fn)());
+
+// 保存当前上下文到from 切换到to
+inline int swap_context(Context* from, Context* to)
+{
+#ifdef SYLAR_ASM_CONTEXT
+	sylar_swap_context(&from->sp, to->sp);
+	return 0;
+#else
+	return swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+// 切出时保存的栈顶 -> 不支持时返回nullptr
+inline void* context_sp(const Context* ctx)
+{
+#ifdef SYLAR_ASM_CONTEXT
+	return ctx->sp;
+#elif defined(__x86_64__)
+	return (void*)ctx->uc.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	return (void*)ctx->uc.uc_mcontext.sp;
+#else
+	return nullptr;
+#endif
+}
+
+// 当前使用的后端名称
+const char* context_backend();
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <new>
+#include <string>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace sylar {
+
+namespace {
+
+int ReadInt(const std::string& path, int def)
+{
+	std::ifstream in(path);
+	int value;
+	return (in >> value) ? value : def;
+}
+
+// "0-3,8,10-11"
+std::vector<int> ReadCpuList(const std::string& path)
+{
+	std::vector<int> cpus;
+	std::ifstream in(path);
+	std::string list;
+	if(!(in >> list))
+	{
+		return cpus;
+	}
+
+	size_t pos = 0;
+	while(pos < list.size())
+	{
+		size_t end = list.find(',', pos);
+		if(end == std::string::npos)
+		{
+			end = list.size();
+		}
+		int first, last;
+		int n = sscanf(list.substr(pos, end - pos).c_str(), "%d-%d", &first, &last);
+		if(n == 1)
+		{
+			last = first;
+		}
+		for(int i=first;n>=1 && i<=last;i++)
+		{
+			cpus.push_back(i);
+		}
+		pos = end + 1;
+	}
+	return cpus;
+}
+
+size_t PageAlign(size_t size)
+{
+	static const size_t s_page = sysconf(_SC_PAGESIZE);
+	return (size + s_page - 1) & ~(s_page - 1);
+}
+
+} // end anonymous namespace
+
+const CpuTopology& CpuTopology::GetInstance()
+{
+	static CpuTopology* s_topology = new CpuTopology();
+	return *s_topology;
+}
+
+CpuTopology::CpuTopology()
+{
+	// CPU -> NUMA节点
+	std::map<int, int> node_of;
+	if(DIR* dir = opendir("/sys/devices/system/node"))
+	{
+		while(dirent* entry = readdir(dir))
+		{
+			int node;
+			if(sscanf(entry->d_name, "node%d", &node) != 1)
+			{
+				continue;
+			}
+			for(int cpu : ReadCpuList(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist"))
+			{
+				node_of[cpu] = node;
+			}
+			m_nodeCount = std::max(m_nodeCount, node + 1);
+		}
+		closedir(dir);
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set))
+	{
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		for(long i=0;i<n && i<CPU_SETSIZE;i++)
+		{
+			CPU_SET(i, &set);
+		}
+	}
+
+	for(int id=0;id<CPU_SETSIZE;id++)
+	{
+		if(!CPU_ISSET(id, &set))
+		{
+			continue;
+		}
+		std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+		Cpu cpu;
+		cpu.id      = id;
+		cpu.core    = ReadInt(path + "core_id", id);
+		cpu.package = ReadInt(path + "physical_package_id", 0);
+		auto it     = node_of.find(id);
+		cpu.node    = it == node_of.end() ? 0 : it->second;
+		cpu.sibling = 0;
+		for(const Cpu& other : m_cpus)
+		{
+			if(other.core == cpu.core && other.package == cpu.package)
+			{
+				cpu.sibling++;
+			}
+		}
+		m_cpus.push_back(cpu);
+	}
+}
+
+const CpuTopology::Cpu* CpuTopology::getCpu(int id) const
+{
+	for(const Cpu& cpu : m_cpus)
+	{
+		if(cpu.id == id)
+		{
+			return &cpu;
+		}
+	}
+	return nullptr;
+}
+
+int CpuTopology::CurrentCpu()
+{
+	return sched_getcpu();
+}
+
+int CpuTopology::CurrentNode()
+{
+	unsigned cpu, node;
+	if(syscall(SYS_getcpu, &cpu, &node, nullptr))
+	{
+		return 0;
+	}
+	return node;
+}
+
+void* CpuTopology::AllocateOnNode(size_t size, int node)
+{
+	size = PageAlign(size);
+	// 匿名映射 -> 物理页在首次访问时才按内存策略分配
+	void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+	{
+		throw std::bad_alloc();
+	}
+
+	unsigned long mask[4] = {0};
+	if(node >= 0 && node < (int)sizeof(mask) * 8 && GetInstance().getNodeCount() > 1)
+	{
+		mask[node / 64] |= 1UL << (node % 64);
+		// 失败时(内核不支持NUMA)按默认的首次访问策略分配
+		syscall(SYS_mbind, p, size, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1, 0);
+	}
+	return p;
+}
+
+void CpuTopology::FreeOnNode(void* p, size_t size)
+{
+	munmap(p, PageAlign(size));
+}
+
+}
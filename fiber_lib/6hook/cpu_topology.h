@@ -0,0 +1,51 @@
+#ifndef _CPU_TOPOLOGY_H_
+#define _CPU_TOPOLOGY_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace sylar {
+
+// CPU拓扑 -> 启动时从/sys读取一次 只包含进程允许使用的CPU(sched_getaffinity)
+// 读取失败的信息按单节点/每个CPU一个物理核处理
+class CpuTopology
+{
+public:
+	struct Cpu
+	{
+		int id;
+		// 物理核 -> 同一个物理核的超线程core和package相同
+		int core;
+		int package;
+		// NUMA节点
+		int node;
+		// 在所属物理核的超线程中的序号 -> 0为第一个
+		int sibling;
+	};
+
+	static const CpuTopology& GetInstance();
+
+	const std::vector<Cpu>& getCpus() const {return m_cpus;}
+	// 不在进程允许使用的CPU中时返回nullptr
+	const Cpu* getCpu(int id) const;
+	int getNodeCount() const {return m_nodeCount;}
+
+	// 当前线程所在的CPU/NUMA节点
+	static int CurrentCpu();
+	static int CurrentNode();
+
+	// 分配size字节的内存 物理页优先从node节点分配(node为-1或只有一个节点时不指定) -> 按页对齐 用FreeOnNode()释放
+	static void* AllocateOnNode(size_t size, int node);
+	static void FreeOnNode(void* p, size_t size);
+
+private:
+	CpuTopology();
+
+private:
+	std::vector<Cpu> m_cpus;
+	int m_nodeCount = 1;
+};
+
+}
+
+#endif
@@ -1,4 +1,11 @@
 #include "fiber.h"
+#include "stack_allocator.h"
+#include "shared_stack.h"
+#include "stack_profiler.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
 
 static bool debug = false;
 
@@ -9,34 +16,137 @@ namespace sylar {
 // 正在运行的协程
 static thread_local Fiber* t_fiber = nullptr;
 // 主协程
-static thread_local std::shared_ptr<Fiber> t_thread_fiber = nullptr;
+static thread_local Fiber::ptr t_thread_fiber = nullptr;
 // 调度协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+// 刚结束的共享栈协程 -> 切换回调度协程/主协程后释放共享栈对它的引用
+static thread_local Fiber* t_finished_shared = nullptr;
 
 // 协程计数器
 static std::atomic<uint64_t> s_fiber_id{0};
 // 协程id
 static std::atomic<uint64_t> s_fiber_count{0};
 
+// 协程局部存储的key和对应的析构函数
+static std::atomic<size_t> s_local_key_count{0};
+static Fiber::LocalDestructor s_local_dtors[Fiber::kMaxLocals];
+
+// 保护页触发的SIGSEGV在备用信号栈上处理 -> 溢出的协程栈已经不可用
+static thread_local bool t_guard_handler = false;
+static struct sigaction s_old_segv_action;
+
+// 信号处理函数中只使用异步信号安全的调用
+static void WriteStderr(const char* msg)
+{
+	size_t len = 0;
+	while(msg[len])
+	{
+		len++;
+	}
+	syscall(SYS_write, 2, msg, len);
+}
+
+static void OnStackGuardFault(int /*sig*/, siginfo_t* info, void* /*ucontext*/)
+{
+	Fiber* f = t_fiber;
+	if(f && f->inGuardPage(info->si_addr))
+	{
+		char buf[32];
+		char* p = buf + sizeof(buf);
+		*--p = '\0';
+		uint64_t id = f->getId();
+		do
+		{
+			*--p = '0' + id % 10;
+			id /= 10;
+		} while(id);
+
+		WriteStderr("fiber stack overflow: fiber id = ");
+		WriteStderr(p);
+		WriteStderr("\n");
+	}
+
+	// 恢复原来的处理方式 -> 返回后重新执行出错指令 -> 按原方式处理(默认为core dump)
+	sigaction(SIGSEGV, &s_old_segv_action, nullptr);
+}
+
+// 每个线程各自的备用信号栈
+struct SignalStack
+{
+	void* stack = nullptr;
+
+	SignalStack()
+	{
+		stack_t ss;
+		ss.ss_size  = 64 * 1024;
+		ss.ss_sp    = stack = malloc(ss.ss_size);
+		ss.ss_flags = 0;
+		sigaltstack(&ss, nullptr);
+	}
+
+	~SignalStack()
+	{
+		stack_t ss;
+		ss.ss_sp    = nullptr;
+		ss.ss_size  = 0;
+		ss.ss_flags = SS_DISABLE;
+		sigaltstack(&ss, nullptr);
+		free(stack);
+	}
+};
+
+static void InstallGuardHandler()
+{
+	static thread_local SignalStack t_signal_stack;
+
+	static std::once_flag s_once;
+	std::call_once(s_once, []()
+	{
+		struct sigaction sa;
+		sa.sa_sigaction = &OnStackGuardFault;
+		sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGSEGV, &sa, &s_old_segv_action);
+	});
+	t_guard_handler = true;
+}
+
 void Fiber::SetThis(Fiber *f)
 {
 	t_fiber = f;
 }
 
 // 首先运行该函数创建主协程
-std::shared_ptr<Fiber> Fiber::GetThis()
+Fiber::ptr Fiber::GetThis()
 {
 	if(t_fiber)
 	{	
-		return t_fiber->shared_from_this();
+		return ptr(t_fiber);
 	}
 
-	std::shared_ptr<Fiber> main_fiber(new Fiber());
+	ptr main_fiber(new Fiber());
 	t_thread_fiber = main_fiber;
 	t_scheduler_fiber = main_fiber.get(); // 除非主动设置 主协程默认为调度协程
 	
 	assert(t_fiber == main_fiber.get());
-	return t_fiber->shared_from_this();
+	return main_fiber;
+}
+
+Fiber* Fiber::Current()
+{
+	return t_fiber;
+}
+
+size_t Fiber::CreateLocalKey(LocalDestructor dtor)
+{
+	size_t key = s_local_key_count++;
+	if(key >= kMaxLocals)
+	{
+		std::cerr << "Fiber::CreateLocalKey() too many keys, max = " << kMaxLocals << std::endl;
+		abort();
+	}
+	s_local_dtors[key] = dtor;
+	return key;
 }
 
 void Fiber::SetSchedulerFiber(Fiber* f)
@@ -57,8 +167,10 @@ Fiber::Fiber()
 {
 	SetThis(this);
 	m_state = RUNNING;
+	// 主协程只属于当前线程
+	m_threadLocal = true;
 	
-	if(getcontext(&m_ctx))
+	if(init_context(&m_ctx))
 	{
 		std::cerr << "Fiber() failed\n";
 		pthread_exit(NULL);
@@ -69,25 +181,47 @@ Fiber::Fiber()
 	if(debug) std::cout << "Fiber(): main id = " << m_id << std::endl;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler):
-m_cb(cb), m_runInScheduler(run_in_scheduler)
+Fiber::Fiber(Callback cb, size_t stacksize, bool run_in_scheduler, StackAllocator* allocator, bool shared_stack):
+m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler)
 {
 	m_state = READY;
+	// 协程创建的协程属于同一个调度组
+	if(t_fiber)
+	{
+		m_group = t_fiber->m_group;
+	}
 
-	// 分配协程栈空间
-	m_stacksize = stacksize ? stacksize : 128000;
-	m_stack = malloc(m_stacksize);
+	if(shared_stack)
+	{
+		// 共享栈 -> 上下文在第一次切换进入时才构造 此时栈上可能还是其他协程的数据
+		m_sharedStack = SharedStack::Next();
+		m_allocator = m_sharedStack->getAllocator();
+		m_stacksize = m_sharedStack->getSize();
+		m_needContext = true;
 
-	if(getcontext(&m_ctx))
+		m_id = s_fiber_id++;
+		s_fiber_count ++;
+		if(debug) std::cout << "Fiber(): shared stack child id = " << m_id << std::endl;
+		return;
+	}
+
+	// 分配协程栈空间 -> 默认来自栈池 大小向上取整到所属的大小等级
+	m_allocator = allocator ? allocator : StackAllocator::GetDefault();
+	size_t size = stacksize ? stacksize : kDefaultStackSize;
+	m_stack = m_allocator->allocate(size);
+	m_stacksize = size;
+	if(!m_stack)
 	{
-		std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
+		std::cerr << "Fiber(Callback cb, size_t stacksize, bool run_in_scheduler) allocate stack failed\n";
+		pthread_exit(NULL);
+	}
+	paintStack();
+
+	if(make_context(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc))
+	{
+		std::cerr << "Fiber(Callback cb, size_t stacksize, bool run_in_scheduler) failed\n";
 		pthread_exit(NULL);
 	}
-	
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
 	
 	m_id = s_fiber_id++;
 	s_fiber_count ++;
@@ -96,31 +230,130 @@ m_cb(cb), m_runInScheduler(run_in_scheduler)
 
 Fiber::~Fiber()
 {
+	// 未运行结束就被释放的协程 -> 局部存储在这里析构
+	clearLocals();
+
 	s_fiber_count --;
 	if(m_stack)
 	{
-		free(m_stack);
+		m_allocator->deallocate(m_stack, m_stacksize);
+	}
+	if(m_saveBuffer)
+	{
+		free(m_saveBuffer);
 	}
 	if(debug) std::cout << "~Fiber(): id = " << m_id << std::endl;	
 }
 
-void Fiber::reset(std::function<void()> cb)
+// 复用协程对象和协程栈 -> 不再经过栈分配器
+void Fiber::reset(Callback cb)
 {
-	assert(m_stack != nullptr&&m_state == TERM);
+	assert((m_stack != nullptr || m_sharedStack != nullptr)&&m_state == TERM);
 
 	m_state = READY;
-	m_cb = cb;
+	m_cb = std::move(cb);
 
-	if(getcontext(&m_ctx))
+	if(m_sharedStack)
+	{
+		m_saveSize = 0;
+		m_needContext = true;
+		return;
+	}
+
+	m_stackTag = nullptr;
+	paintStack();
+
+	if(make_context(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc))
 	{
 		std::cerr << "reset() failed\n";
 		pthread_exit(NULL);
 	}
+}
 
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
+void* Fiber::setLocal(size_t key)
+{
+	assert(key < kMaxLocals);
+	clearLocal(key);
+	m_localMask |= 1u << key;
+	return &m_locals[key];
+}
+
+void Fiber::clearLocal(size_t key)
+{
+	if((m_localMask >> key) & 1)
+	{
+		// 先清除标记 -> 析构函数中再次访问该key时看到的是未设置
+		m_localMask &= ~(1u << key);
+		if(s_local_dtors[key])
+		{
+			s_local_dtors[key](&m_locals[key]);
+		}
+	}
+}
+
+void Fiber::clearLocals()
+{
+	// 析构函数中可能设置新的值 -> 直到全部清除
+	while(m_localMask)
+	{
+		clearLocal(__builtin_ctz(m_localMask));
+	}
+}
+
+bool Fiber::inGuardPage(const void* addr) const
+{
+	const void* stack = m_sharedStack ? m_sharedStack->getStack() : m_stack;
+	if(!m_allocator || !stack)
+	{
+		return false;
+	}
+	const char* low = (const char*)stack - m_allocator->guardSize();
+	return addr >= low && addr < stack;
+}
+
+void Fiber::paintStack()
+{
+	m_stackSite = m_cb.target_id();
+	m_stackPainted = StackProfiler::IsEnabled();
+	if(m_stackPainted)
+	{
+		StackProfiler::Paint(m_stack, m_stacksize);
+	}
+}
+
+void Fiber::saveStack()
+{
+	char* top = (char*)m_sharedStack->getStack() + m_sharedStack->getSize();
+	char* sp  = (char*)context_sp(&m_ctx);
+	assert(sp != nullptr && sp < top);
+
+	// 缓冲区按实际用量分配 -> 不够或明显偏大时重新分配
+	size_t used = top - sp;
+	if(m_saveCapacity < used || m_saveCapacity > used * 2)
+	{
+		free(m_saveBuffer);
+		m_saveBuffer = (char*)malloc(used);
+		m_saveCapacity = used;
+	}
+	memcpy(m_saveBuffer, sp, used);
+	m_saveSize = used;
+}
+
+void Fiber::restoreStack()
+{
+	if(m_needContext)
+	{
+		if(make_context(&m_ctx, m_sharedStack->getStack(), m_stacksize, &Fiber::MainFunc))
+		{
+			std::cerr << "restoreStack() failed\n";
+			pthread_exit(NULL);
+		}
+		m_needContext = false;
+		return;
+	}
+
+	char* top = (char*)m_sharedStack->getStack() + m_sharedStack->getSize();
+	memcpy(top - m_saveSize, m_saveBuffer, m_saveSize);
 }
 
 void Fiber::resume()
@@ -129,10 +362,12 @@ void Fiber::resume()
 	
 	m_state = RUNNING;
 
+	prepareSwitchIn();
+
 	if(m_runInScheduler)
 	{
 		SetThis(this);
-		if(swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))
+		if(swap_context(&(t_scheduler_fiber->m_ctx), &m_ctx))
 		{
 			std::cerr << "resume() to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -141,12 +376,20 @@ void Fiber::resume()
 	else
 	{
 		SetThis(this);
-		if(swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+		if(swap_context(&(t_thread_fiber->m_ctx), &m_ctx))
 		{
 			std::cerr << "resume() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
 		}	
 	}
+
+	// 结束的可能是交接后运行的其他协程 -> 此时它已不在任何栈上运行
+	if(t_finished_shared)
+	{
+		Fiber* finished = t_finished_shared;
+		t_finished_shared = nullptr;
+		finished->m_sharedStack->release(finished);
+	}
 }
 
 void Fiber::yield()
@@ -161,7 +404,7 @@ void Fiber::yield()
 	if(m_runInScheduler)
 	{
 		SetThis(t_scheduler_fiber);
-		if(swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx)))
+		if(swap_context(&m_ctx, &(t_scheduler_fiber->m_ctx)))
 		{
 			std::cerr << "yield() to to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -170,7 +413,7 @@ void Fiber::yield()
 	else
 	{
 		SetThis(t_thread_fiber.get());
-		if(swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
+		if(swap_context(&m_ctx, &(t_thread_fiber->m_ctx)))
 		{
 			std::cerr << "yield() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
@@ -178,19 +421,65 @@ void Fiber::yield()
 	}	
 }
 
+void Fiber::yieldTo(Fiber* target)
+{
+	assert(t_fiber==this && m_state==RUNNING);
+	assert(target!=this && target->m_state==READY && target->m_runInScheduler==m_runInScheduler);
+	// 当前协程正占用target的共享栈 -> 栈内容还没有保存 不能换出
+	assert(!target->m_sharedStack || target->m_sharedStack!=m_sharedStack);
+
+	m_state = READY;
+	target->m_state = RUNNING;
+
+	target->prepareSwitchIn();
+
+	SetThis(target);
+	if(swap_context(&m_ctx, &target->m_ctx))
+	{
+		std::cerr << "yieldTo() failed\n";
+		pthread_exit(NULL);
+	}
+}
+
+void Fiber::prepareSwitchIn()
+{
+	// 带保护页的协程栈 -> 当前线程需要备用信号栈和SIGSEGV处理函数
+	if(!t_guard_handler && m_allocator && m_allocator->guardSize())
+	{
+		InstallGuardHandler();
+	}
+
+	// 共享栈 -> 换出当前占用者 换入本协程
+	if(m_sharedStack)
+	{
+		m_sharedStack->switchIn(this);
+	}
+}
+
 void Fiber::MainFunc()
 {
-	std::shared_ptr<Fiber> curr = GetThis();
+	// resume()的调用者持有引用 -> 这里使用裸指针即可
+	Fiber* curr = Current();
 	assert(curr!=nullptr);
 
 	curr->m_cb(); 
 	curr->m_cb = nullptr;
+	// 协程局部存储在结束前析构 -> 析构函数仍运行在本协程中
+	curr->clearLocals();
 	curr->m_state = TERM;
+	if(curr->m_sharedStack)
+	{
+		t_finished_shared = curr;
+	}
+
+	// 记录栈高水位
+	if(curr->m_stackPainted)
+	{
+		StackProfiler::Record(curr->m_stackSite, curr->m_stackTag, StackProfiler::HighWaterMark(curr->m_stack, curr->m_stacksize));
+	}
 
 	// 运行完毕 -> 让出执行权
-	auto raw_ptr = curr.get();
-	curr.reset(); 
-	raw_ptr->yield(); 
+	curr->yield(); 
 }
 
 }
\ No newline at end of file
@@ -6,15 +6,36 @@
 #include <atomic>       
 #include <functional>   
 #include <cassert>      
-#include <ucontext.h>   
+#include "context.h"
+#include "intrusive_ptr.h"
+#include "unique_function.h"
 #include <unistd.h>
 #include <mutex>
 
 namespace sylar {
 
-class Fiber : public std::enable_shared_from_this<Fiber>
+class StackAllocator;
+class SharedStack;
+class SchedulingGroup;
+
+class Fiber
 {
+	friend class SharedStack;
 public:
+	// 侵入式引用计数 -> 不需要shared_ptr的控制块 也不需要shared_from_this()
+	typedef IntrusivePtr<Fiber> ptr;
+
+	// 默认栈大小
+	static const size_t kDefaultStackSize = 128000;
+
+	// 默认调度优先级 -> 与Scheduler::NORMAL相同(scheduler.h中静态检查) fiber.h不能包含scheduler.h
+	static const int kDefaultPriority = 1;
+
+	// 协程局部存储的槽位数
+	static const size_t kMaxLocals = 16;
+	// 协程局部存储的析构函数 -> 参数为槽位地址
+	typedef void (*LocalDestructor)(void* slot);
+
 	// 协程状态
 	enum State
 	{
@@ -28,26 +49,98 @@ private:
 	Fiber();
 
 public:
-	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+	// allocator为空时使用默认的栈分配器
+	// shared_stack为true时 在当前线程的共享栈上运行(忽略stacksize和allocator) -> 该协程只能在当前线程上恢复执行
+	Fiber(Callback cb, size_t stacksize = 0, bool run_in_scheduler = true, StackAllocator* allocator = nullptr, bool shared_stack = false);
 	~Fiber();
 
 	// 重用一个协程
-	void reset(std::function<void()> cb);
+	void reset(Callback cb);
 
 	// 任务线程恢复执行
 	void resume();
 	// 任务线程让出执行权
 	void yield();
+	// 当前协程直接切换到target 不经过调度协程/主协程 -> 之后target让出时回到调度协程/主协程
+	// 调用者负责之后重新恢复当前协程 一般通过Scheduler::handoff()使用
+	void yieldTo(Fiber* target);
 
 	uint64_t getId() const {return m_id;}
 	State getState() const {return m_state;}
+	size_t getStackSize() const {return m_stacksize;}
+	// 使用的共享栈 -> 独立栈协程返回nullptr
+	SharedStack* getSharedStack() const {return m_sharedStack;}
+
+	// 引用计数
+	void addRef()
+	{
+		if(m_threadLocal)
+		{
+			m_refCount.store(m_refCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+		else
+		{
+			m_refCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// 返回true -> 最后一个引用
+	bool release()
+	{
+		if(m_threadLocal)
+		{
+			uint32_t n = m_refCount.load(std::memory_order_relaxed) - 1;
+			m_refCount.store(n, std::memory_order_relaxed);
+			return n == 0;
+		}
+		return m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+	}
+
+	uint32_t getRefCount() const {return m_refCount.load(std::memory_order_relaxed);}
+
+	// 该协程只在当前线程内被引用(主协程/调度协程/空闲协程) -> 引用计数不需要原子操作
+	void markThreadLocal() {m_threadLocal = true;}
+
+	// 地址是否落在该协程栈的保护页内
+	bool inGuardPage(const void* addr) const;
+
+	// 协程局部存储 -> 一般通过FiberLocal<T>使用
+	// 槽位地址 -> 未设置时返回nullptr
+	void* getLocal(size_t key) {return (m_localMask >> key) & 1 ? &m_locals[key] : nullptr;}
+	// 析构原来的值并把槽位标记为已设置 -> 返回槽位地址 由调用者在其中构造新值
+	void* setLocal(size_t key);
+	// 析构并清除槽位
+	void clearLocal(size_t key);
+	// 析构并清除所有槽位 -> 协程结束时调用
+	void clearLocals();
+
+	// 栈高水位统计按标签汇总(默认按回调的调用点) -> tag需要在整个程序运行期间有效(如字符串字面量)
+	// 调用点记为该标签的别名 -> 调度器按调用点查询建议栈大小时得到标签的统计
+	void setStackTag(const char* tag) {m_stackTag = tag;}
+
+	// 调度优先级(Scheduler::Priority) -> 协程被调度(IO就绪/定时器/唤醒)且未指定优先级时使用
+	// 回调任务的协程为提交回调时的优先级 其他协程只由setPriority()改变
+	int getPriority() const {return m_priority;}
+	void setPriority(int priority) {m_priority = priority;}
+	// 截止时间(steady_clock毫秒 0为没有) -> 调度器运行任务时设置 协程被重新调度时沿用 见Scheduler::scheduleDeadline()
+	uint64_t getDeadline() const {return m_deadline;}
+	void setDeadline(uint64_t deadline) {m_deadline = deadline;}
+	// 调度组(nullptr为不属于任何组) -> 创建时继承当前协程的调度组 同上
+	SchedulingGroup* getGroup() const {return m_group;}
+	void setGroup(SchedulingGroup* group) {m_group = group;}
 
 public:
 	// 设置当前运行的协程
 	static void SetThis(Fiber *f);
 
-	// 得到当前运行的协程 
-	static std::shared_ptr<Fiber> GetThis();
+	// 注册协程局部存储的key -> 应在程序初始化时调用(如全局/静态的FiberLocal对象) 槽位用完时退出进程
+	static size_t CreateLocalKey(LocalDestructor dtor);
+
+	// 得到当前运行的协程 -> 没有时创建主协程
+	static ptr GetThis();
+
+	// 当前运行的协程(裸指针 不增加引用计数) -> 没有时返回nullptr
+	static Fiber* Current();
 
 	// 设置调度协程（默认为主协程）
 	static void SetSchedulerFiber(Fiber* f);
@@ -58,6 +151,16 @@ public:
 	// 协程函数
 	static void MainFunc();	
 
+private:
+	// 切换进入本协程前的准备 -> 保护页信号处理 / 换入共享栈
+	void prepareSwitchIn();
+	// 栈高水位统计开启时 用哨兵值填充独立栈
+	void paintStack();
+	// 共享栈协程: 把共享栈上实际用到的部分拷贝到保存缓冲区
+	void saveStack();
+	// 共享栈协程: 把保存缓冲区拷贝回共享栈 首次运行时构造上下文
+	void restoreStack();
+
 private:
 	// id
 	uint64_t m_id = 0;
@@ -66,13 +169,39 @@ private:
 	// 协程状态
 	State m_state = READY;
 	// 协程上下文
-	ucontext_t m_ctx;
+	Context m_ctx;
 	// 协程栈指针
 	void* m_stack = nullptr;
+	// 协程栈分配器
+	StackAllocator* m_allocator = nullptr;
+	// 共享栈
+	SharedStack* m_sharedStack = nullptr;
+	// 共享栈协程的保存缓冲区
+	char* m_saveBuffer = nullptr;
+	size_t m_saveSize = 0;
+	size_t m_saveCapacity = 0;
+	// 共享栈协程: 上下文需要在下一次切换进入时构造
+	bool m_needContext = false;
+	// 栈高水位统计: 栈已用哨兵值填充 / 调用点(回调的类型标识) / 标签
+	bool m_stackPainted = false;
+	const void* m_stackSite = nullptr;
+	const char* m_stackTag = nullptr;
+	// 协程局部存储 -> 每个槽位放得下一个指针 m_localMask记录已设置的槽位
+	std::aligned_storage<sizeof(void*), alignof(void*)>::type m_locals[kMaxLocals];
+	uint32_t m_localMask = 0;
 	// 协程函数
-	std::function<void()> m_cb;
+	Callback m_cb;
+	// 调度优先级
+	int m_priority = kDefaultPriority;
+	// 截止时间
+	uint64_t m_deadline = 0;
+	// 调度组
+	SchedulingGroup* m_group = nullptr;
 	// 是否让出执行权交给调度协程
 	bool m_runInScheduler;
+	// 引用计数
+	std::atomic<uint32_t> m_refCount{0};
+	bool m_threadLocal = false;
 
 public:
 	std::mutex m_mutex;
@@ -0,0 +1,99 @@
+#ifndef _FIBER_LOCAL_H_
+#define _FIBER_LOCAL_H_
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "fiber.h"
+
+namespace sylar {
+
+// 协程局部存储
+// 与thread_local不同 -> 值跟随协程 协程被调度到其他线程上恢复执行后仍然可见
+// 每个FiberLocal对象在构造时注册一个key -> 对应协程内部槽位数组的下标 -> get()/set()为O(1)的数组访问
+// 不超过一个指针大小的可平凡拷贝类型(trace id/deadline/裸指针)直接存放在槽位中 -> 其他类型在堆上分配 槽位中存放指针
+// 值在协程结束(TERM)时析构
+// 用法:
+//   static sylar::FiberLocal<uint64_t> s_trace_id;
+//   s_trace_id.set(id);
+//   if(uint64_t* p = s_trace_id.get()) {...}
+// key的数量有限(Fiber::kMaxLocals) -> FiberLocal应定义为全局或静态对象 不要动态创建
+template<class T>
+class FiberLocal
+{
+private:
+	static constexpr bool kInline = sizeof(T) <= sizeof(void*) && alignof(T) <= alignof(void*)
+		&& std::is_trivially_copyable<T>::value;
+
+public:
+	FiberLocal(): m_key(Fiber::CreateLocalKey(kInline ? nullptr : &Destroy)) {}
+
+	FiberLocal(const FiberLocal&) = delete;
+	FiberLocal& operator=(const FiberLocal&) = delete;
+
+	// 当前协程的值 -> 未设置时返回nullptr
+	T* get() const
+	{
+		void* slot = CurrentFiber()->getLocal(m_key);
+		if(!slot)
+		{
+			return nullptr;
+		}
+		if constexpr (kInline)
+		{
+			return static_cast<T*>(slot);
+		}
+		else
+		{
+			return *static_cast<T**>(slot);
+		}
+	}
+
+	// 设置当前协程的值 -> 原来的值被析构
+	template<class... Args>
+	T& set(Args&&... args)
+	{
+		if constexpr (kInline)
+		{
+			void* slot = CurrentFiber()->setLocal(m_key);
+			return *new (slot) T(std::forward<Args>(args)...);
+		}
+		else
+		{
+			// 先构造新值 -> 构造抛出异常时槽位保持原样
+			T* value = new T(std::forward<Args>(args)...);
+			void* slot = CurrentFiber()->setLocal(m_key);
+			new (slot) T*(value);
+			return *value;
+		}
+	}
+
+	// 析构并清除当前协程的值
+	void reset()
+	{
+		CurrentFiber()->clearLocal(m_key);
+	}
+
+	T* operator->() const {return get();}
+
+private:
+	static void Destroy(void* slot)
+	{
+		delete *static_cast<T**>(slot);
+	}
+
+	// 不在任何协程中时(线程刚启动) -> 使用线程的主协程
+	static Fiber* CurrentFiber()
+	{
+		Fiber* f = Fiber::Current();
+		return f ? f : Fiber::GetThis().get();
+	}
+
+private:
+	size_t m_key;
+};
+
+}
+
+#endif
@@ -162,7 +162,7 @@ retry:
         } 
         else 
         {
-            sylar::Fiber::GetThis()->yield();
+            sylar::Fiber::Current()->yield();
      
             // 3 resume either by addEvent or cancelEvent
             if(timer) 
@@ -202,7 +202,7 @@ unsigned int sleep(unsigned int seconds)
         return sleep_f(seconds);
     }
 
-    std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     // add a timer to reschedule this fiber
     iom->addTimer(seconds*1000, [fiber, iom](){iom->scheduleLock(fiber, -1);});
@@ -218,10 +218,10 @@ int usleep(useconds_t usec)
         return usleep_f(usec);
     }
 
-    std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     // add a timer to reschedule this fiber
-    iom->addTimer(usec/1000, [fiber, iom](){iom->scheduleLock(fiber);});
+    iom->addTimer(std::chrono::microseconds(usec), [fiber, iom](){iom->scheduleLock(fiber);});
     // wait for the next resume
     fiber->yield();
     return 0;
@@ -234,12 +234,12 @@ int nanosleep(const struct timespec* req, struct timespec* rem)
         return nanosleep_f(req, rem);
     }	
 
-    int timeout_ms = req->tv_sec*1000 + req->tv_nsec/1000/1000;
+    auto timeout = std::chrono::seconds(req->tv_sec) + std::chrono::nanoseconds(req->tv_nsec);
 
-    std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     // add a timer to reschedule this fiber
-    iom->addTimer(timeout_ms, [fiber, iom](){iom->scheduleLock(fiber, -1);});
+    iom->addTimer(timeout, [fiber, iom](){iom->scheduleLock(fiber, -1);});
     // wait for the next resume
     fiber->yield();	
     return 0;
@@ -321,7 +321,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
     if(rt == 0) 
     {
-        sylar::Fiber::GetThis()->yield();
+        sylar::Fiber::Current()->yield();
 
         // resume either by addEvent or cancelEvent
         if(timer) 
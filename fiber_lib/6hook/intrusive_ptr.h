@@ -0,0 +1,92 @@
+#ifndef _INTRUSIVE_PTR_H_
+#define _INTRUSIVE_PTR_H_
+
+#include <cstddef>
+#include <utility>
+
+namespace sylar {
+
+// 侵入式引用计数指针
+// 引用计数保存在对象内部 -> T需要提供 addRef() / release() / getRefCount()
+// release()返回true表示最后一个引用已经释放 -> 由指针负责delete
+template<class T>
+class IntrusivePtr
+{
+public:
+	IntrusivePtr() {}
+	IntrusivePtr(std::nullptr_t) {}
+
+	explicit IntrusivePtr(T* p): m_ptr(p)
+	{
+		if(m_ptr)
+		{
+			m_ptr->addRef();
+		}
+	}
+
+	IntrusivePtr(const IntrusivePtr& other): IntrusivePtr(other.m_ptr) {}
+
+	IntrusivePtr(IntrusivePtr&& other) noexcept: m_ptr(other.m_ptr)
+	{
+		other.m_ptr = nullptr;
+	}
+
+	~IntrusivePtr()
+	{
+		if(m_ptr && m_ptr->release())
+		{
+			delete m_ptr;
+		}
+	}
+
+	IntrusivePtr& operator=(const IntrusivePtr& other)
+	{
+		IntrusivePtr(other).swap(*this);
+		return *this;
+	}
+
+	IntrusivePtr& operator=(IntrusivePtr&& other) noexcept
+	{
+		IntrusivePtr(std::move(other)).swap(*this);
+		return *this;
+	}
+
+	IntrusivePtr& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	void reset(T* p = nullptr)
+	{
+		IntrusivePtr(p).swap(*this);
+	}
+
+	void swap(IntrusivePtr& other) noexcept
+	{
+		std::swap(m_ptr, other.m_ptr);
+	}
+
+	T* get() const {return m_ptr;}
+	T* operator->() const {return m_ptr;}
+	T& operator*() const {return *m_ptr;}
+	explicit operator bool() const {return m_ptr != nullptr;}
+
+	size_t use_count() const {return m_ptr ? m_ptr->getRefCount() : 0;}
+
+private:
+	T* m_ptr = nullptr;
+};
+
+template<class T>
+bool operator==(const IntrusivePtr<T>& lhs, const IntrusivePtr<T>& rhs) {return lhs.get() == rhs.get();}
+template<class T>
+bool operator!=(const IntrusivePtr<T>& lhs, const IntrusivePtr<T>& rhs) {return lhs.get() != rhs.get();}
+template<class T>
+bool operator==(const IntrusivePtr<T>& lhs, std::nullptr_t) {return lhs.get() == nullptr;}
+template<class T>
+bool operator!=(const IntrusivePtr<T>& lhs, std::nullptr_t) {return lhs.get() != nullptr;}
+
+}
+
+#endif
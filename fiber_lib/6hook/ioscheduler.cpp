@@ -1,7 +1,9 @@
 #include <unistd.h>    
 #include <sys/epoll.h> 
+#include <sys/syscall.h>
 #include <fcntl.h>     
 #include <cstring>
+#include <ctime>
 
 #include "ioscheduler.h"
 
@@ -9,6 +11,29 @@ static bool debug = false;
 
 namespace sylar {
 
+// wait at most timeout_ns
+// epoll_pwait2 (Linux 5.11+) takes a timespec -> timers keep their sub-millisecond precision
+// older kernels fall back to epoll_wait, rounded up to whole milliseconds -> never wakes before the timer and spins
+static int EpollWait(int epfd, epoll_event* events, int maxevents, uint64_t timeout_ns)
+{
+#ifdef SYS_epoll_pwait2
+    static std::atomic<bool> s_pwait2{true};
+    if(s_pwait2.load(std::memory_order_relaxed))
+    {
+        timespec ts;
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        int rt = syscall(SYS_epoll_pwait2, epfd, events, maxevents, &ts, nullptr, 0);
+        if(rt >= 0 || errno != ENOSYS)
+        {
+            return rt;
+        }
+        s_pwait2.store(false, std::memory_order_relaxed);
+    }
+#endif
+    return epoll_wait(epfd, events, maxevents, (int)((timeout_ns + 999999) / 1000000));
+}
+
 IOManager* IOManager::GetThis() 
 {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
@@ -32,10 +57,12 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.priority = NORMAL;
+    ctx.group = nullptr;
 }
 
 // no lock
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, ReadyList* ready) {
     assert(events & event);
 
     // delete event 
@@ -43,15 +70,33 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     
     // trigger
     EventContext& ctx = getEventContext(event);
-    if (ctx.cb) 
+    if (ctx.cb && ctx.group && ctx.priority == NORMAL) 
     {
-        // call ScheduleTask(std::function<void()>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.cb);
+        // goes to the queue of its group -> fibers carry their group themselves
+        // other priorities are not fair-shared -> scheduled by priority below
+        ctx.scheduler->scheduleGroup(ctx.group, std::move(ctx.cb));
+    } 
+    else if (ready && ctx.scheduler == ready->scheduler) 
+    {
+        // scheduled together with the other events of this round
+        if (ctx.cb) 
+        {
+            ready->cbs[ctx.priority].push_back(std::move(ctx.cb));
+        } 
+        else 
+        {
+            ready->fibers.push_back(std::move(ctx.fiber));
+        }
+    } 
+    else if (ctx.cb) 
+    {
+        // call ScheduleTask(Callback* f, int thr, int prio)
+        ctx.scheduler->scheduleLock(&ctx.cb, -1, ctx.priority);
     } 
     else 
     {
-        // call ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.fiber);
+        // call ScheduleTask(Fiber::ptr* f, int thr, int prio)
+        ctx.scheduler->scheduleLock(&ctx.fiber, -1, ctx.priority);
     }
 
     // reset event context
@@ -59,8 +104,8 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name): 
-Scheduler(threads, use_caller, name), TimerManager()
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, const Placement& placement, size_t max_threads, TimerManager::Backend timer_backend): 
+Scheduler(threads, use_caller, name, placement, max_threads), TimerManager(timer_backend, getWorkerCount() + 1)
 {
     // create epoll fd
     m_epfd = epoll_create(5000);
@@ -117,7 +162,7 @@ void IOManager::contextResize(size_t size)
     }
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) 
+int IOManager::addEvent(int fd, Event event, Callback cb) 
 {
     // attemp to find FdContext 
     FdContext *fd_ctx = nullptr;
@@ -166,6 +211,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
     FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
     assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
     event_ctx.scheduler = Scheduler::GetThis();
+    // registered outside of any fiber -> NORMAL
+    Fiber* curr = Fiber::Current();
+    event_ctx.priority = curr ? curr->getPriority() : NORMAL;
+    event_ctx.group    = curr ? curr->getGroup() : nullptr;
     if (cb) 
     {
         event_ctx.cb.swap(cb);
@@ -334,15 +383,51 @@ void IOManager::tickle()
     {
         return;
     }
+    // prefer a parked thread -> the poller keeps waiting for IO
+    if(unparkOne())
+    {
+        return;
+    }
+    wakePoller();
+}
+
+void IOManager::tickleWorker(size_t index) 
+{
+    unpark(index);
+    // seq_cst -> pairs with the poller checking its mailbox after claiming the poller role
+    if(m_poller.load() == (int)index)
+    {
+        wakePoller();
+    }
+}
+
+void IOManager::tickleMany(size_t count) 
+{
+    if(!hasIdleThreads()) 
+    {
+        return;
+    }
+    while(count > 0 && unparkOne())
+    {
+        --count;
+    }
+    // not enough parked threads -> the poller takes the rest
+    if(count > 0)
+    {
+        wakePoller();
+    }
+}
+
+void IOManager::wakePoller() 
+{
     int rt = write(m_tickleFds[1], "T", 1);
     assert(rt == 1);
 }
 
 bool IOManager::stopping() 
 {
-    uint64_t timeout = getNextTimer();
     // no timers left and no pending events left with the Scheduler::stopping()
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 
@@ -350,6 +435,8 @@ void IOManager::idle()
 {    
     static const uint64_t MAX_EVNETS = 256;
     std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVNETS]);
+    ReadyList ready;
+    ready.scheduler = this;
 
     while (true) 
     {
@@ -358,18 +445,43 @@ void IOManager::idle()
         if(stopping()) 
         {
             if(debug) std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadId() << std::endl;
+            // wake up the next idle thread -> otherwise it only notices at the end of its epoll_wait timeout
+            tickle();
             break;
         }
 
+        // an elastic worker idle for longer than its cool-down exits
+        if(retire())
+        {
+            return;
+        }
+
+        // only one idle thread waits in epoll_wait at a time (the poller)
+        // the others park on their own condition variable -> a task pinned to a thread wakes exactly that thread
+        int expected = -1;
+        if(!m_poller.compare_exchange_strong(expected, getWorkerIndex()))
+        {
+            park();
+            Fiber::Current()->yield();
+            continue;
+        }
+        // a task pinned to this thread may have been tickled before it became the poller
+        if(hasPinnedTasks())
+        {
+            m_poller = -1;
+            Fiber::Current()->yield();
+            continue;
+        }
+
         // blocked at epoll_wait
         int rt = 0;
         while(true)
         {
-            static const uint64_t MAX_TIMEOUT = 5000;
-            uint64_t next_timeout = getNextTimer();
+            static const uint64_t MAX_TIMEOUT = 5000ull * 1000 * 1000;
+            uint64_t next_timeout = getNextTimerNs();
             next_timeout = std::min(next_timeout, MAX_TIMEOUT);
 
-            rt = epoll_wait(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
+            rt = EpollWait(m_epfd, events.get(), MAX_EVNETS, next_timeout);
             // EINTR -> retry
             if(rt < 0 && errno == EINTR) 
             {
@@ -381,19 +493,14 @@ void IOManager::idle()
             }
         };
 
+        // give up the poller role before dispatching -> callbacks scheduled below wake a parked thread that polls next
+        m_poller = -1;
+
         // collect all timers overdue
-        std::vector<std::function<void()>> cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()) 
-        {
-            for(const auto& cb : cbs) 
-            {
-                scheduleLock(cb);
-            }
-            cbs.clear();
-        }
+        listExpiredCb(ready.cbs[NORMAL]);
         
         // collect all events ready
+        size_t triggered = 0;
         for (int i = 0; i < rt; ++i) 
         {
             epoll_event& event = events[i];
@@ -447,24 +554,49 @@ void IOManager::idle()
             // schedule callback and update fdcontext and event context
             if (real_events & READ) 
             {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(READ, &ready);
+                ++triggered;
             }
             if (real_events & WRITE) 
             {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+                fd_ctx->triggerEvent(WRITE, &ready);
+                ++triggered;
             }
         } // end for
 
-        Fiber::GetThis()->yield();
+        // schedule the whole round at once -> one enqueue and as many wake-ups as there are tasks
+        for (int i = 0; i < kPriorityCount; ++i) 
+        {
+            scheduleBatch(ready.cbs[i].begin(), ready.cbs[i].end(), -1, i);
+            ready.cbs[i].clear();
+        }
+        scheduleBatch(ready.fibers.begin(), ready.fibers.end());
+        ready.fibers.clear();
+        // only now -> stopping() must not see the collected callbacks as neither pending nor queued
+        m_pendingEventCount -= triggered;
+
+        Fiber::Current()->yield();
   
     } // end while(true)
 }
 
+size_t IOManager::getShard() 
+{
+    // -1 -> shard 0
+    return getWorkerIndex() + 1;
+}
+
 void IOManager::onTimerInsertedAtFront() 
 {
-    tickle();
+    // only the poller waits with a timeout -> without a poller, wake a parked thread to become one
+    if(m_poller.load() != -1)
+    {
+        wakePoller();
+    }
+    else
+    {
+        tickle();
+    }
 }
 
 } // end namespace sylar
\ No newline at end of file
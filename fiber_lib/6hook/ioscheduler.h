@@ -21,6 +21,15 @@ public:
     };
 
 private:
+    // callbacks and fibers made ready during one round of idle() -> scheduled with one scheduleBatch() each
+    struct ReadyList 
+    {
+        Scheduler* scheduler = nullptr;
+        // one list per priority -> fibers carry their own priority
+        std::vector<Callback> cbs[kPriorityCount];
+        std::vector<Fiber::ptr> fibers;
+    };
+
     struct FdContext 
     {
         struct EventContext 
@@ -28,9 +37,12 @@ private:
             // scheduler
             Scheduler *scheduler = nullptr;
             // callback fiber
-            std::shared_ptr<Fiber> fiber;
+            Fiber::ptr fiber;
             // callback function
-            std::function<void()> cb;
+            Callback cb;
+            // priority and scheduling group of the fiber that registered the event -> kept when it becomes ready
+            int priority = NORMAL;
+            SchedulingGroup* group = nullptr;
         };
 
         // read event context
@@ -44,15 +56,19 @@ private:
 
         EventContext& getEventContext(Event event);
         void resetEventContext(EventContext &ctx);
-        void triggerEvent(Event event);        
+        // ready != nullptr -> collect the callback instead of scheduling it when it belongs to ready->scheduler
+        void triggerEvent(Event event, ReadyList* ready = nullptr);        
     };
 
 public:
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    // max_threads > threads -> elastic pool, see Scheduler
+    // timer_backend -> data structure holding the timers, see TimerManager
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager", const Placement& placement = Placement(), size_t max_threads = 0,
+              TimerManager::Backend timer_backend = TimerManager::WHEEL);
     ~IOManager();
 
     // add one event at a time
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, Callback cb = nullptr);
     // delete event
     bool delEvent(int fd, Event event);
     // delete the event and trigger its callback
@@ -64,6 +80,13 @@ public:
 
 protected:
     void tickle() override;
+
+    void tickleWorker(size_t index) override;
+
+    void tickleMany(size_t count) override;
+
+    // interrupt the epoll_wait of the poller
+    void wakePoller();
     
     bool stopping() override;
     
@@ -71,6 +94,9 @@ protected:
 
     void onTimerInsertedAtFront() override;
 
+    // timers created on a worker thread live on that worker's shard, other threads share shard 0
+    size_t getShard() override;
+
     void contextResize(size_t size);
 
 private:
@@ -78,6 +104,8 @@ private:
     // fd[0] read，fd[1] write
     int m_tickleFds[2];
     std::atomic<size_t> m_pendingEventCount = {0};
+    // worker index of the thread waiting in epoll_wait -> -1 if none
+    std::atomic<int> m_poller = {-1};
     std::shared_mutex m_mutex;
     // store fdcontexts for each fd
     std::vector<FdContext *> m_fdContexts;
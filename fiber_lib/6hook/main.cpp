@@ -13,6 +13,50 @@
 
 static int sock_listen_fd = -1;
 
+#ifdef SYLAR_COUNT_ALLOCS
+// 统计每个请求的堆分配次数
+// g++ *.cpp -std=c++17 -DSYLAR_COUNT_ALLOCS -o main -ldl -lpthread
+#include <atomic>
+static std::atomic<uint64_t> s_alloc_count{0};
+static std::atomic<uint64_t> s_request_count{0};
+
+void* operator new(size_t size)
+{
+    s_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size);
+    if (!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+// 每1000个请求输出一次平均分配次数
+static void count_request()
+{
+    static std::atomic<uint64_t> s_last_alloc{0};
+    uint64_t n = ++s_request_count;
+    if (n % 1000 == 0)
+    {
+        uint64_t allocs = s_alloc_count.load(std::memory_order_relaxed);
+        uint64_t last = s_last_alloc.exchange(allocs);
+        std::cout << "requests = " << n << ", allocations per request = " << (allocs - last) / 1000.0 << std::endl;
+    }
+}
+#else
+static void count_request() {}
+#endif
+
 void test_accept();
 void error(const char *msg)
 {
@@ -66,6 +110,7 @@ void test_accept()
 
                     // 关闭连接
                      close(fd);
+                     count_request();
                      break;
                 }
                 if (ret <= 0)
@@ -0,0 +1,221 @@
+#ifndef _MPMC_QUEUE_H_
+#define _MPMC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <sys/mman.h>
+
+namespace sylar {
+
+// 多生产者多消费者无锁队列
+// 主体为有界环形数组(参考Dmitry Vyukov的bounded MPMC queue) -> 每个槽位带序号 push/pop各一次CAS
+// 环形数组用mmap预留 物理页在首次用到时才提交 -> 容量可以设得很大(如百万个槽位) 只有积压到这么多时才占用这么多内存
+// 积压超过容量(上界)后才放入加锁的溢出链表 -> 溢出链表不为空时新元素也放入溢出链表 -> 保持大致的先进先出 避免溢出的元素饥饿
+// 元素直接构造在槽位中 -> 入队出队不需要额外的堆分配 T需要可默认构造和移动
+template<class T>
+class MpmcQueue
+{
+private:
+	// 构造时预先提交的字节数
+	static const size_t kPrefaultBytes = 1024 * 1024;
+
+	// 槽位的序号存为相对于槽位下标的值 -> 全0(mmap的新页)即为初始状态 构造时不需要逐个写入而提交所有的页
+	struct Cell
+	{
+		std::atomic<size_t> seq;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type data;
+	};
+
+public:
+	// capacity需要是2的幂 -> 超过它的积压进入加锁的溢出链表
+	explicit MpmcQueue(size_t capacity = 8192): m_mask(capacity - 1)
+	{
+		m_bytes = capacity * sizeof(Cell);
+		void* p = mmap(nullptr, m_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(p == MAP_FAILED)
+		{
+			std::cerr << "MpmcQueue() mmap failed, capacity = " << capacity << std::endl;
+			abort();
+		}
+		m_buffer = (Cell*)p;
+		// 大页 -> 积压增长时缺页次数少得多
+		madvise(p, m_bytes, MADV_HUGEPAGE);
+		// 预先提交开头的一部分 -> 通常的积压不会在提交任务时缺页
+		size_t prefault = std::min(m_bytes, kPrefaultBytes);
+		for(size_t i=0;i<prefault;i+=4096)
+		{
+			((volatile char*)p)[i] = 0;
+		}
+	}
+
+	~MpmcQueue()
+	{
+		// 析构还在环形数组中的元素
+		T x;
+		while(tryPop(x))
+		{
+		}
+		munmap(m_buffer, m_bytes);
+	}
+
+	MpmcQueue(const MpmcQueue&) = delete;
+	MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+	void push(T&& x)
+	{
+		if(m_overflowCount.load(std::memory_order_acquire) == 0 && tryPush(x))
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_overflow.push_back(std::move(x));
+		m_overflowCount.fetch_add(1, std::memory_order_release);
+	}
+
+	// 批量放入[first, last)中的元素 -> 环形数组满了之后剩余的元素只加一次锁放入溢出链表
+	template<class It>
+	void push(It first, It last)
+	{
+		if(m_overflowCount.load(std::memory_order_acquire) == 0)
+		{
+			for(;first!=last && tryPush(*first);++first)
+			{
+			}
+		}
+		if(first == last)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t n = 0;
+		for(;first!=last;++first,++n)
+		{
+			m_overflow.push_back(std::move(*first));
+		}
+		m_overflowCount.fetch_add(n, std::memory_order_release);
+	}
+
+	// 队列为空时返回false
+	bool pop(T& x)
+	{
+		if(tryPop(x))
+		{
+			return true;
+		}
+		if(m_overflowCount.load(std::memory_order_acquire) == 0)
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_overflow.empty())
+		{
+			return false;
+		}
+		x = std::move(m_overflow.front());
+		m_overflow.pop_front();
+		m_overflowCount.fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	// 近似值 -> 并发修改时只用于判断是否为空/统计
+	size_t size() const
+	{
+		size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+		size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+		return (enq > deq ? enq - deq : 0) + m_overflowCount.load(std::memory_order_relaxed);
+	}
+
+	bool empty() const {return size() == 0;}
+
+private:
+	// 失败时x保持不变
+	bool tryPush(T& x)
+	{
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			size_t index = pos & m_mask;
+			Cell* cell = &m_buffer[index];
+			size_t seq = cell->seq.load(std::memory_order_acquire) + index;
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0)
+			{
+				// 槽位空闲 -> 占用
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					new (&cell->data) T(std::move(x));
+					cell->seq.store(pos + 1 - index, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(diff < 0)
+			{
+				// 满
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool tryPop(T& x)
+	{
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			size_t index = pos & m_mask;
+			Cell* cell = &m_buffer[index];
+			size_t seq = cell->seq.load(std::memory_order_acquire) + index;
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(diff == 0)
+			{
+				if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					T* data = reinterpret_cast<T*>(&cell->data);
+					x = std::move(*data);
+					data->~T();
+					// 槽位留给下一轮的生产者
+					cell->seq.store(pos + m_mask + 1 - index, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(diff < 0)
+			{
+				// 空
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	Cell* m_buffer;
+	size_t m_mask;
+	size_t m_bytes;
+	// 生产者和消费者的位置放在不同的缓存行
+	alignas(64) std::atomic<size_t> m_enqueuePos{0};
+	alignas(64) std::atomic<size_t> m_dequeuePos{0};
+
+	// 溢出链表
+	alignas(64) std::atomic<size_t> m_overflowCount{0};
+	std::mutex m_mutex;
+	std::deque<T> m_overflow;
+};
+
+}
+
+#endif
@@ -1,4 +1,13 @@
 #include "scheduler.h"
+#include "stack_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <tuple>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 static bool debug = false;
 
@@ -6,6 +15,97 @@ namespace sylar {
 
 static thread_local Scheduler* t_scheduler = nullptr;
 
+// 交接(handoff)状态
+// run()正在恢复的任务协程 -> run()持有它的锁
+static thread_local Fiber* t_task_fiber = nullptr;
+// 交接过程中加锁的协程 -> 在run()重新获得执行权(此时它们的上下文都已保存)后解锁
+static thread_local std::vector<Fiber::ptr> t_handoff_locked;
+// 交接后让出的协程 -> 只在本线程上按顺序恢复
+static thread_local std::deque<Fiber::ptr> t_handoff_queue;
+
+// 当前线程作为哪个调度器的第几个工作线程
+static thread_local Scheduler* t_worker_scheduler = nullptr;
+static thread_local void* t_worker = nullptr;
+
+// 每隔多少次调度优先检查一次全局队列 / 从本地队列顶部(最早放入的任务)取任务
+static const uint64_t kGlobalCheckInterval = 61;
+static const uint64_t kLocalFifoInterval   = 31;
+// 优先级老化 -> 每隔多少次调度先取NORMAL / BACKGROUND的任务
+static const uint64_t kNormalFirstInterval     = 8;
+static const uint64_t kBackgroundFirstInterval = 32;
+
+static const char* const kPriorityNames[Scheduler::kPriorityCount] = {"critical", "normal", "background"};
+
+// 本地队列任务节点的线程缓存
+static const size_t kTaskCacheSize = 256;
+
+// 工作线程的挂起状态
+static const int32_t kParkEmpty    = 0;
+static const int32_t kParkWaiting  = 1;
+static const int32_t kParkNotified = 2;
+
+// 值仍为expected时挂起 -> 被唤醒/值已改变/超过timeout_ms毫秒(-1为不超时)时返回
+static void FutexWait(std::atomic<int32_t>* addr, int32_t expected, uint64_t timeout_ms = -1)
+{
+	timespec ts;
+	ts.tv_sec  = timeout_ms / 1000;
+	ts.tv_nsec = timeout_ms % 1000 * 1000000;
+	syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAIT_PRIVATE, expected, 
+		timeout_ms == (uint64_t)-1 ? nullptr : &ts, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<int32_t>* addr)
+{
+	syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+static uint64_t NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t NowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 虚拟运行时间 = 运行时间 * kWeightScale / 权重
+static const uint64_t kWeightScale = 1024;
+
+// value = max(value, x)
+static void RaiseTo(std::atomic<uint64_t>& value, uint64_t x)
+{
+	uint64_t curr = value.load();
+	while(curr < x && !value.compare_exchange_weak(curr, x))
+	{
+	}
+}
+
+// 自旋等待时让出流水线 -> 降低功耗和对同一物理核上另一个超线程的影响
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+struct TaskNodeCache
+{
+	std::vector<void*> nodes;
+
+	~TaskNodeCache()
+	{
+		for(void* p : nodes)
+		{
+			::operator delete(p);
+		}
+	}
+};
+
+static thread_local TaskNodeCache t_task_nodes;
+
 Scheduler* Scheduler::GetThis()
 {
 	return t_scheduler;
@@ -16,8 +116,116 @@ void Scheduler::SetThis()
 	t_scheduler = this;
 }
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name):
-m_useCaller(use_caller), m_name(name)
+// 按绑定策略为n个工作线程分配CPU -> 不绑定时为空
+static std::vector<std::vector<int>> PlaceWorkers(const Placement& placement, size_t n)
+{
+	std::vector<std::vector<int>> result(n);
+	const CpuTopology& topology = CpuTopology::GetInstance();
+
+	std::vector<const CpuTopology::Cpu*> cpus;
+	if(placement.cpus.empty())
+	{
+		for(auto& cpu : topology.getCpus())
+		{
+			cpus.push_back(&cpu);
+		}
+	}
+	for(int id : placement.cpus)
+	{
+		if(const CpuTopology::Cpu* cpu = topology.getCpu(id))
+		{
+			cpus.push_back(cpu);
+		}
+	}
+	if(cpus.empty() || n == 0)
+	{
+		return result;
+	}
+
+	switch(placement.policy)
+	{
+	case Placement::CPU:
+	{
+		std::stable_sort(cpus.begin(), cpus.end(), [](const CpuTopology::Cpu* a, const CpuTopology::Cpu* b)
+		{
+			return std::tie(a->sibling, a->node, a->package, a->core) < std::tie(b->sibling, b->node, b->package, b->core);
+		});
+		for(size_t i=0;i<n;i++)
+		{
+			result[i].push_back(cpus[i % cpus.size()]->id);
+		}
+		break;
+	}
+	case Placement::CPUSET:
+	{
+		for(size_t i=0;i<n;i++)
+		{
+			for(auto cpu : cpus)
+			{
+				result[i].push_back(cpu->id);
+			}
+		}
+		break;
+	}
+	case Placement::PHYSICAL_CORE:
+	{
+		// 按NUMA节点/物理核分组
+		std::map<std::tuple<int, int, int>, std::vector<int>> cores;
+		for(auto cpu : cpus)
+		{
+			cores[std::make_tuple(cpu->node, cpu->package, cpu->core)].push_back(cpu->id);
+		}
+		// 每个NUMA节点的物理核
+		std::map<int, std::vector<std::vector<int>>> nodes;
+		for(auto& i : cores)
+		{
+			nodes[std::get<0>(i.first)].push_back(i.second);
+		}
+		// 轮流从每个节点取一个物理核 -> 工作线程少于物理核时也分散到所有节点上
+		std::vector<std::vector<int>> groups;
+		for(size_t round=0;groups.size()<cores.size();round++)
+		{
+			for(auto& i : nodes)
+			{
+				if(round < i.second.size())
+				{
+					groups.push_back(i.second[round]);
+				}
+			}
+		}
+		for(size_t i=0;i<n;i++)
+		{
+			result[i] = groups[i % groups.size()];
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return result;
+}
+
+// 一组CPU所在的NUMA节点 -> 为空或跨节点时返回-1
+static int NodeOf(const std::vector<int>& cpus)
+{
+	int node = -1;
+	for(int id : cpus)
+	{
+		const CpuTopology::Cpu* cpu = CpuTopology::GetInstance().getCpu(id);
+		if(!cpu || (node != -1 && cpu->node != node))
+		{
+			return -1;
+		}
+		node = cpu->node;
+	}
+	return node;
+}
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, const Placement& placement, size_t max_threads):
+m_useCaller(use_caller), m_name(name),
+// 积压超过环形数组的容量后才放入加锁的溢出链表 -> 环形数组的内存按实际积压提交
+// NORMAL最多约1M个任务无锁 CRITICAL/BACKGROUND的任务一般较少 各64K
+m_injectQueues{MpmcQueue<ScheduleTask>(1 << 16), MpmcQueue<ScheduleTask>(1 << 20), MpmcQueue<ScheduleTask>(1 << 16)}
 {
 	assert(threads>0 && Scheduler::GetThis()==nullptr);
 
@@ -35,6 +243,7 @@ m_useCaller(use_caller), m_name(name)
 
 		// 创建调度协程
 		m_schedulerFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, false)); // false -> 该调度协程退出后将返回主协程
+		m_schedulerFiber->markThreadLocal();
 		Fiber::SetSchedulerFiber(m_schedulerFiber.get());
 		
 		m_rootThread = Thread::GetThreadId();
@@ -42,6 +251,37 @@ m_useCaller(use_caller), m_name(name)
 	}
 
 	m_threadCount = threads;
+	// 弹性工作线程数
+	size_t elastic = max_threads > threads + (m_useCaller ? 1 : 0) ? max_threads - threads - (m_useCaller ? 1 : 0) : 0;
+
+	// 工作线程 -> 线程启动前按最大线程数创建 窃取和指定线程调度时可以访问所有线程
+	std::vector<std::vector<int>> cpus = PlaceWorkers(placement, m_threadCount + elastic);
+	m_workers.resize(m_threadCount + elastic + (m_useCaller ? 1 : 0));
+	for(size_t i=0;i<m_workers.size();i++)
+	{
+		// 主线程不绑定
+		std::vector<int> worker_cpus;
+		if(!m_useCaller || i > 0)
+		{
+			worker_cpus = cpus[i - (m_useCaller ? 1 : 0)];
+		}
+		int node = NodeOf(worker_cpus);
+		m_workers[i].reset(new (node) Worker());
+		m_workers[i]->index   = i;
+		m_workers[i]->cpus    = worker_cpus;
+		m_workers[i]->node    = node;
+		m_workers[i]->elastic = i >= m_threadCount + (m_useCaller ? 1 : 0);
+	}
+	if(m_useCaller)
+	{
+		m_workers[0]->threadId = m_rootThread;
+		m_workers[0]->running  = true;
+	}
+
+	m_parkedMask.reset(new std::atomic<uint64_t>[(m_workers.size() + 63) / 64]());
+
+	m_groups[0].reset(new SchedulingGroup("default", 1));
+	m_groupCount = 1;
 	if(debug) std::cout << "Scheduler::Scheduler() success\n";
 }
 
@@ -65,15 +305,126 @@ void Scheduler::start()
 	}
 
 	assert(m_threads.empty());
-	m_threads.resize(m_threadCount);
+
+	m_threads.resize(m_workers.size() - (m_useCaller ? 1 : 0));
 	for(size_t i=0;i<m_threadCount;i++)
 	{
-		m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
-		m_threadIds.push_back(m_threads[i]->getId());
+		Worker* worker = m_workers[i + (m_useCaller ? 1 : 0)].get();
+		startWorker(worker);
+		m_threadIds.push_back(worker->threadId);
+	}
+
+	// 有弹性工作线程 -> 启动监控线程
+	if(m_workers.back()->elastic)
+	{
+		m_monitor.reset(new Thread(std::bind(&Scheduler::monitor, this), m_name + "_monitor"));
 	}
 	if(debug) std::cout << "Scheduler::start() success\n";
 }
 
+void Scheduler::startWorker(Worker* worker)
+{
+	size_t slot = worker->index - (m_useCaller ? 1 : 0);
+	worker->running  = true;
+	worker->lastBusy = NowMs();
+	m_threads[slot].reset(new Thread([this, worker]()
+	{
+		// 线程内部也设置一次 -> 构造函数返回之前 本线程上的任务就可以按线程id指定它
+		worker->threadId = Thread::GetThreadId();
+		t_worker_scheduler = this;
+		t_worker = worker;
+		run();
+		// 之后grow()可以重新使用这个工作线程 -> 先join()这个线程
+		worker->running = false;
+	}, m_name + "_" + std::to_string(slot), worker->cpus));
+	worker->threadId = m_threads[slot]->getId();
+}
+
+void Scheduler::monitor()
+{
+	// 所有线程开始忙碌的时间 -> 0表示有空闲线程或没有等待的任务
+	uint64_t busy_since = 0;
+	std::unique_lock<std::mutex> lock(m_monitorMutex);
+	while(!m_monitorStop)
+	{
+		uint64_t grow_after = m_growAfter;
+		m_monitorCond.wait_for(lock, std::chrono::milliseconds(std::max<uint64_t>(grow_after / 4, 1)));
+		if(m_monitorStop)
+		{
+			break;
+		}
+
+		// 没有空闲线程 且有任意线程都可以运行的任务在等待 -> 所有线程都在执行任务(或阻塞在没有hook的调用中)
+		// 信箱中的任务只能由指定的线程运行 -> 增加线程没有帮助
+		if(m_idleThreadCount > 0 || !hasStealableTasks())
+		{
+			busy_since = 0;
+			continue;
+		}
+		uint64_t now = NowMs();
+		if(busy_since == 0)
+		{
+			busy_since = now;
+		}
+		else if(now - busy_since >= grow_after)
+		{
+			if(debug) std::cout << "Scheduler::monitor() grows " << m_name << std::endl;
+			grow();
+			// 新线程开始运行后 再等待一个周期才判断是否继续增加
+			busy_since = now;
+		}
+	}
+}
+
+bool Scheduler::grow()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_stopping)
+	{
+		return false;
+	}
+	for(auto& w : m_workers)
+	{
+		if(!w->elastic || w->running)
+		{
+			continue;
+		}
+		// 上一个在这个位置运行的线程已经退出(或正在退出)
+		std::shared_ptr<Thread>& thread = m_threads[w->index - (m_useCaller ? 1 : 0)];
+		if(thread)
+		{
+			thread->join();
+		}
+		startWorker(w.get());
+		return true;
+	}
+	return false;
+}
+
+bool Scheduler::retire()
+{
+	Worker* worker = localWorker();
+	if(!worker || !worker->elastic || NowMs() - worker->lastBusy < m_retireAfter)
+	{
+		return false;
+	}
+	// 挂起在本线程共享栈上的协程只能在本线程恢复 -> 用过共享栈的线程不退出
+	if(SharedStack::Count() > 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(worker->mailboxMutex);
+	if(worker->mailboxCount > 0)
+	{
+		return false;
+	}
+	// 之后按线程id指定本线程的任务改为不指定线程 -> 见schedulePinned()
+	worker->threadId = -1;
+	if(debug) std::cout << "Scheduler::retire() in thread: " << Thread::GetThreadId() << std::endl;
+	return true;
+}
+
 void Scheduler::run()
 {
 	int thread_id = Thread::GetThreadId();
@@ -89,35 +440,57 @@ void Scheduler::run()
 		Fiber::GetThis();
 	}
 
-	std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
+	// 主线程为0号工作线程 -> 其他线程在start()中设置
+	if(thread_id == m_rootThread)
+	{
+		t_worker_scheduler = this;
+		t_worker = m_workers[0].get();
+	}
+	Worker* worker = localWorker();
+	assert(worker != nullptr);
+	worker->seed = thread_id;
+	worker->spin = m_idleSpin;
+
+	Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+	idle_fiber->markThreadLocal();
+	Fiber::ptr cb_fiber;
 	ScheduleTask task;
+	// 上一次进入空闲之后是否执行过任务
+	bool busy = true;
 	
 	while(true)
 	{
 		task.reset();
 		bool tickle_me = false;
 
+		// 查找任务期间就计为活跃 -> 任务从队列中取出到开始执行之间 stopping()不会误判为没有任务
+		m_activeThreadCount++;
+		bool found = false;
+
+		// 0 优先恢复本线程交接队列中的协程 -> 不需要加锁
+		if(!t_handoff_queue.empty())
 		{
-			std::lock_guard<std::mutex> lock(m_mutex);
-			auto it = m_tasks.begin();
-			// 1 遍历任务队列
-			while(it!=m_tasks.end())
-			{
-				if(it->thread!=-1&&it->thread!=thread_id)
-				{
-					it++;
-					tickle_me = true;
-					continue;
-				}
+			task.fiber = std::move(t_handoff_queue.front());
+			t_handoff_queue.pop_front();
+			// 与重新调度的协程相同 -> 运行时长计入协程所在的调度组
+			task.priority = task.fiber->getPriority();
+			task.deadline = task.fiber->getDeadline();
+			task.group    = task.fiber->getGroup();
+			found = true;
+		}
+		// 1 按优先级查找信箱/本地队列/全局队列/其他线程的本地队列
+		else
+		{
+			found = take(worker, task, tickle_me);
+		}
 
-				// 2 取出任务
-				assert(it->fiber||it->cb);
-				task = *it;
-				m_tasks.erase(it); 
-				m_activeThreadCount++;
-				break;
-			}	
-			tickle_me = tickle_me || (it != m_tasks.end());
+		if(!found)
+		{
+			m_activeThreadCount--;
+		}
+		else
+		{
+			busy = true;
 		}
 
 		if(tickle_me)
@@ -125,30 +498,77 @@ void Scheduler::run()
 			tickle();
 		}
 
-		// 3 执行任务
+		// 有调度组时统计NORMAL任务的运行时长 -> 不属于任何组的计入默认组 其他优先级的任务不参与公平调度
+		SchedulingGroup* charged = nullptr;
+		uint64_t start = 0;
+		if(found && m_groupCount > 1)
+		{
+			charged = task.priority != NORMAL ? nullptr : task.group ? task.group : (!task.deadline ? m_groups[0].get() : nullptr);
+			start = charged ? NowNs() : 0;
+		}
+
+		// 2 执行任务
 		if(task.fiber)
 		{
 			{					
 				std::lock_guard<std::mutex> lock(task.fiber->m_mutex);
 				if(task.fiber->getState()!=Fiber::TERM)
 				{
+					// 之后协程被重新调度时沿用这个截止时间 -> 任务没有截止时间(交接/未指定)时保留协程原来的截止时间
+					// 优先级只对本次调度有效 不改变协程自己的优先级
+					if(task.deadline)
+					{
+						task.fiber->setDeadline(task.deadline);
+					}
+					t_task_fiber = task.fiber.get();
 					task.fiber->resume();	
+					ReleaseHandoff();
 				}
 			}
 			m_activeThreadCount--;
 			task.reset();
+			if(charged)
+			{
+				charge(charged, NowNs() - start);
+			}
 		}
 		else if(task.cb)
 		{
-			std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
+			// 按统计选择栈大小 -> 0表示默认大小
+			size_t stacksize = m_stackAutoSizing ? StackProfiler::Recommend(task.cb.target_id()) : 0;
+			size_t need = stacksize ? stacksize : Fiber::kDefaultStackSize;
+
+			// 复用上一个已经结束的任务协程 -> 省去协程对象和协程栈的分配 -> 栈大小需要与本任务匹配
+			if(cb_fiber && cb_fiber->getStackSize() >= need && cb_fiber->getStackSize() < need * 2)
+			{
+				cb_fiber->reset(std::move(task.cb));
+			}
+			else
+			{
+				cb_fiber.reset(new Fiber(std::move(task.cb), stacksize));
+			}
+			cb_fiber->setPriority(task.priority);
+			cb_fiber->setDeadline(task.deadline);
+			cb_fiber->setGroup(task.group);
 			{
 				std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
+				t_task_fiber = cb_fiber.get();
 				cb_fiber->resume();			
+				ReleaseHandoff();
 			}
 			m_activeThreadCount--;
+			// 未结束(让出执行权)或仍被其他地方引用 -> 不能复用
+			if(cb_fiber->getState()!=Fiber::TERM || cb_fiber.use_count()>1)
+			{
+				cb_fiber.reset();
+			}
 			task.reset();	
+			if(charged)
+			{
+				charge(charged, NowNs() - start);
+			}
 		}
-		// 4 无任务 -> 执行空闲协程
+		// 3 无任务 -> 执行空闲协程
 		else
 		{		
 			// 系统关闭 -> idle协程将从死循环跳出并结束 -> 此时的idle协程状态为TERM -> 再次进入将跳出循环并退出run()
@@ -157,81 +577,926 @@ void Scheduler::run()
             	if(debug) std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
                 break;
             }
+			if(busy)
+			{
+				worker->cpu = CpuTopology::CurrentCpu();
+				worker->lastBusy = NowMs();
+				busy = false;
+			}
 			m_idleThreadCount++;
+			worker->idle = true;
+			// 先登记为空闲线程再检查一次队列 -> 与提交任务时先入队再检查空闲线程数配对 -> 不会在有任务时进入空闲而错过唤醒
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(worker->mailboxCount > 0 || hasStealableTasks())
+			{
+				worker->idle = false;
+				m_idleThreadCount--;
+				continue;
+			}
 			idle_fiber->resume();				
+			worker->idle = false;
 			m_idleThreadCount--;
+			// 弹性工作线程空闲超时退出
+			if(worker->threadId == -1)
+			{
+				if(debug) std::cout << "Schedule::run() retires in thread: " << thread_id << std::endl;
+				break;
+			}
 		}
 	}
-	
+
+	t_worker_scheduler = nullptr;
+	t_worker = nullptr;
 }
 
-void Scheduler::stop()
+void Scheduler::dump(std::ostream& os)
 {
-	if(debug) std::cout << "Schedule::stop() starts in thread: " << Thread::GetThreadId() << std::endl;
-	
-	if(stopping())
+	const CpuTopology& topology = CpuTopology::GetInstance();
+	os << "scheduler = " << m_name << ", workers = " << m_workers.size() 
+	   << ", numa nodes = " << topology.getNodeCount() << ", queued =";
+	for(int i=0;i<kPriorityCount;i++)
 	{
-		return;
+		os << " " << kPriorityNames[i] << ":" << getQueueDepth(i);
 	}
-
-	m_stopping = true;	
-
-    if (m_useCaller) 
-    {
-        assert(GetThis() == this);
-    } 
-    else 
-    {
-        assert(GetThis() != this);
-    }
-	
-	for (size_t i = 0; i < m_threadCount; i++) 
+	os << " deadline:" << m_deadlineCount[CRITICAL] + m_deadlineCount[NORMAL] + m_deadlineCount[BACKGROUND] << ", deadline misses = " << m_deadlineMisses << std::endl;
+	for(size_t i=0;i<m_groupCount;i++)
 	{
-		tickle();
+		SchedulingGroup* g = m_groups[i].get();
+		os << "group = " << g->getName() << ", weight = " << g->getWeight() 
+		   << ", queued = " << g->getQueueDepth() << ", runs = " << g->getRunCount()
+		   << ", run time = " << g->getRunTime() / 1000 << "us" << std::endl;
 	}
-
-	if (m_schedulerFiber) 
+	for(auto& w : m_workers)
 	{
-		tickle();
+		os << "worker = " << w->index << ", thread = " << w->threadId;
+		if(w->elastic)
+		{
+			os << ", elastic = " << (w->running ? "running" : "stopped");
+		}
+		os << ", cpus = ";
+		if(w->cpus.empty())
+		{
+			os << "any";
+		}
+		for(size_t i=0;i<w->cpus.size();i++)
+		{
+			os << (i ? "," : "") << w->cpus[i];
+		}
+		int cpu = w->cpu;
+		const CpuTopology::Cpu* info = topology.getCpu(cpu);
+		os << ", node = " << w->node
+		   << ", last cpu = " << cpu
+		   << ", last node = " << (info ? info->node : -1)
+		   << ", local tasks =";
+		for(int i=0;i<kPriorityCount;i++)
+		{
+			os << (i ? "/" : " ") << w->queues[i].size();
+		}
+		os << ", pinned tasks = " << w->mailboxCount << std::endl;
 	}
+}
 
-	if(m_schedulerFiber)
+size_t Scheduler::getQueueDepth(int priority)
+{
+	assert(priority >= 0 && priority < kPriorityCount);
+	size_t n = m_injectQueues[priority].size();
+	for(auto& w : m_workers)
 	{
-		m_schedulerFiber->resume();
-		if(debug) std::cout << "m_schedulerFiber ends in thread:" << Thread::GetThreadId() << std::endl;
+		n += w->queues[priority].size();
+		if(w->mailboxCount > 0)
+		{
+			std::lock_guard<std::mutex> lock(w->mailboxMutex);
+			n += w->mailbox[priority].size();
+		}
 	}
+	return n;
+}
 
-	std::vector<std::shared_ptr<Thread>> thrs;
+bool Scheduler::hasStealableTasks() const
+{
+	if(m_groupedCount > 0)
 	{
-		std::lock_guard<std::mutex> lock(m_mutex);
-		thrs.swap(m_threads);
+		return true;
 	}
-
-	for(auto &i : thrs)
+	for(int i=0;i<kPriorityCount;i++)
+	{
+		if(m_deadlineCount[i] > 0 || !m_injectQueues[i].empty())
+		{
+			return true;
+		}
+	}
+	for(auto& w : m_workers)
 	{
-		i->join();
+		for(int i=0;i<kPriorityCount;i++)
+		{
+			if(!w->queues[i].empty())
+			{
+				return true;
+			}
+		}
 	}
-	if(debug) std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+	return false;
 }
 
-void Scheduler::tickle()
+Scheduler::Worker* Scheduler::localWorker() const
 {
+	return t_worker_scheduler == this ? (Worker*)t_worker : nullptr;
 }
 
-void Scheduler::idle()
+Scheduler::Worker* Scheduler::workerOf(int thread) const
 {
-	while(!stopping())
+	// 大多数指定线程的任务在所属线程上提交(共享栈协程/重新调度自己)
+	Worker* worker = localWorker();
+	if(worker && worker->threadId == thread)
+	{
+		return worker;
+	}
+	for(auto& w : m_workers)
 	{
-		if(debug) std::cout << "Scheduler::idle(), sleeping in thread: " << Thread::GetThreadId() << std::endl;	
-		sleep(1);	
-		Fiber::GetThis()->yield();
+		if(w->threadId == thread)
+		{
+			return w.get();
+		}
 	}
+	return nullptr;
 }
 
-bool Scheduler::stopping() 
+void Scheduler::Unpin(ScheduleTask* tasks, size_t n)
+{
+	for(size_t i=0;i<n;i++)
+	{
+		// 共享栈协程只能在共享栈所属的线程上恢复 -> 在其他线程上恢复会把保存的栈拷贝到别的线程的共享栈上
+		if(tasks[i].fiber && tasks[i].fiber->getSharedStack())
+		{
+			std::cerr << "Scheduler: shared-stack fiber " << tasks[i].fiber->getId() 
+					  << " belongs to thread " << tasks[i].thread << " which is not a worker of this scheduler" << std::endl;
+			abort();
+		}
+		tasks[i].thread = -1;
+	}
+}
+
+bool Scheduler::schedulePinned(int thread, ScheduleTask* tasks, size_t n)
 {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+	Worker* target = workerOf(thread);
+	if(!target)
+	{
+		// 不是本调度器的工作线程 -> 由任意工作线程运行
+		Unpin(tasks, n);
+		return false;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(target->mailboxMutex);
+		// 查找之后目标线程退出了(弹性工作线程) -> 同上
+		if(target->threadId != thread)
+		{
+			lock.unlock();
+			Unpin(tasks, n);
+			return false;
+		}
+		for(size_t i=0;i<n;i++)
+		{
+			target->mailbox[tasks[i].priority].push_back(std::move(tasks[i]));
+		}
+		target->mailboxCount += n;
+	}
+	// 先放入信箱再检查目标线程是否空闲 -> 与run()中先登记空闲再检查信箱配对
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(target->idle)
+	{
+		tickleWorker(target->index);
+	}
+	return true;
+}
+
+void Scheduler::scheduleUnpinned(std::vector<ScheduleTask>& tasks)
+{
+	// 有截止时间的任务放到最后 -> 一次放入截止时间堆
+	auto end = std::stable_partition(tasks.begin(), tasks.end(), [](const ScheduleTask& t) {return t.deadline == 0;});
+	if(end != tasks.end())
+	{
+		pushDeadline(&*end, tasks.end() - end);
+	}
+	// 属于调度组的NORMAL任务 -> 放入组的队列
+	auto grouped = std::stable_partition(tasks.begin(), end, [](const ScheduleTask& t) {return t.group == nullptr || t.priority != NORMAL;});
+	if(grouped != end)
+	{
+		pushGroup(&*grouped, end - grouped);
+		end = grouped;
+	}
+
+	Worker* worker = localWorker();
+	if(worker)
+	{
+		for(auto it = tasks.begin(); it != end; ++it)
+		{
+			worker->queues[it->priority].push(NewTask(std::move(*it)));
+		}
+	}
+	else
+	{
+		// 按优先级分组 -> 每个优先级的全局队列只批量放入一次
+		std::stable_sort(tasks.begin(), end, [](const ScheduleTask& a, const ScheduleTask& b)
+		{
+			return a.priority < b.priority;
+		});
+		for(auto first = tasks.begin(); first != end;)
+		{
+			int priority = first->priority;
+			auto last = std::find_if(first, end, [priority](const ScheduleTask& t) {return t.priority != priority;});
+			m_injectQueues[priority].push(first, last);
+			first = last;
+		}
+	}
+
+	// 先入队再检查空闲线程 -> 与run()中先登记空闲再检查队列配对
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	size_t idle = m_idleThreadCount;
+	if(idle > 0)
+	{
+		tickleMany(std::min(tasks.size(), idle));
+	}
+}
+
+// 截止时间堆的比较 -> 截止时间相同时先放入的先运行
+static bool LaterDeadline(uint64_t d1, uint64_t s1, uint64_t d2, uint64_t s2)
+{
+	return d1 != d2 ? d1 > d2 : s1 > s2;
+}
+
+void Scheduler::pushDeadline(ScheduleTask* tasks, size_t n)
+{
+	auto later = [](const DeadlineTask& a, const DeadlineTask& b) {return LaterDeadline(a.task.deadline, a.seq, b.task.deadline, b.seq);};
+	std::lock_guard<std::mutex> lock(m_deadlineMutex);
+	for(size_t i=0;i<n;i++)
+	{
+		int priority = tasks[i].priority;
+		std::vector<DeadlineTask>& heap = m_deadlineTasks[priority];
+		heap.push_back(DeadlineTask{m_deadlineSeq++, std::move(tasks[i])});
+		std::push_heap(heap.begin(), heap.end(), later);
+		m_deadlineCount[priority]++;
+	}
+}
+
+void Scheduler::scheduleDeadline(Fiber::ptr fiber, uint64_t timeout_ms)
+{
+	if(fiber)
+	{
+		fiber->setDeadline(NowMs() + timeout_ms);
+	}
+	scheduleLock(std::move(fiber));
+}
+
+void Scheduler::scheduleDeadline(Callback cb, uint64_t timeout_ms)
+{
+	ScheduleTask task(std::move(cb), -1);
+	if(!task.cb)
+	{
+		return;
+	}
+	task.deadline = NowMs() + timeout_ms;
+	std::vector<ScheduleTask> tasks;
+	tasks.push_back(std::move(task));
+	scheduleUnpinned(tasks);
+}
+
+SchedulingGroup* Scheduler::createGroup(const std::string& name, uint32_t weight)
+{
+	std::lock_guard<std::mutex> lock(m_groupMutex);
+	size_t n = m_groupCount;
+	if(n >= kMaxGroups)
+	{
+		return nullptr;
+	}
+	m_groups[n].reset(new SchedulingGroup(name, weight));
+	m_groups[n]->m_vruntime = m_minVruntime.load();
+	// 先创建再发布 -> pickGroup()不加锁遍历
+	m_groupCount.store(n + 1, std::memory_order_release);
+	return m_groups[n].get();
+}
+
+void Scheduler::scheduleGroup(SchedulingGroup* group, Callback cb)
+{
+	ScheduleTask task(std::move(cb), -1);
+	if(!task.cb)
+	{
+		return;
+	}
+	task.group = group;
+	std::vector<ScheduleTask> tasks;
+	tasks.push_back(std::move(task));
+	scheduleUnpinned(tasks);
+}
+
+void Scheduler::pushGroup(ScheduleTask* tasks, size_t n)
+{
+	for(size_t i=0;i<n;i++)
+	{
+		SchedulingGroup* group = tasks[i].group;
+		assert(group && tasks[i].priority == NORMAL);
+		std::lock_guard<std::mutex> lock(group->m_mutex);
+		if(group->m_tasks.empty())
+		{
+			// 空闲期间不累积虚拟运行时间 -> 从当前的最小值开始 否则重新有任务后会连续占用
+			RaiseTo(group->m_vruntime, m_minVruntime);
+		}
+		group->m_tasks.push_back(std::move(tasks[i]));
+		group->m_count++;
+		m_groupedCount++;
+	}
+}
+
+SchedulingGroup* Scheduler::pickGroup() const
+{
+	SchedulingGroup* best = nullptr;
+	size_t n = m_groupCount.load(std::memory_order_acquire);
+	for(size_t i=0;i<n;i++)
+	{
+		SchedulingGroup* group = m_groups[i].get();
+		if(group->m_count > 0 && (!best || group->m_vruntime < best->m_vruntime))
+		{
+			best = group;
+		}
+	}
+	return best;
+}
+
+bool Scheduler::takeGroup(SchedulingGroup* group, ScheduleTask& task, bool& tickle_me)
+{
+	std::lock_guard<std::mutex> lock(group->m_mutex);
+	if(group->m_tasks.empty())
+	{
+		return false;
+	}
+	task = std::move(group->m_tasks.front());
+	group->m_tasks.pop_front();
+	group->m_count--;
+	m_groupedCount--;
+	// 还有任务 -> 唤醒其他空闲线程
+	tickle_me = tickle_me || m_groupedCount > 0;
+	return true;
+}
+
+void Scheduler::charge(SchedulingGroup* group, uint64_t ns)
+{
+	group->m_runTime += ns;
+	group->m_runCount++;
+	// 被选中运行的组的虚拟运行时间在有任务的组中最小 -> 单调推进最小值
+	uint64_t vruntime = group->m_vruntime.fetch_add(ns * kWeightScale / group->m_weight);
+	RaiseTo(m_minVruntime, vruntime);
+}
+
+void Scheduler::SetDeadline(uint64_t timeout_ms)
+{
+	Fiber* curr = Fiber::Current();
+	if(curr)
+	{
+		curr->setDeadline(timeout_ms ? NowMs() + timeout_ms : 0);
+	}
+}
+
+int Scheduler::getWorkerIndex() const
+{
+	Worker* worker = localWorker();
+	return worker ? (int)worker->index : -1;
+}
+
+bool Scheduler::hasPinnedTasks() const
+{
+	Worker* worker = localWorker();
+	return worker && worker->mailboxCount > 0;
+}
+
+bool Scheduler::spin()
+{
+	Worker* worker = localWorker();
+	assert(worker != nullptr);
+
+	uint32_t limit = std::min(worker->spin, m_idleSpin);
+	for(uint32_t i=0;i<limit;i++)
+	{
+		if(worker->parkState == kParkNotified || worker->mailboxCount > 0 || hasStealableTasks())
+		{
+			// 等到了 -> 下次多自旋一会
+			worker->spin = std::min(std::max(worker->spin * 2, 1u), m_idleSpin);
+			return true;
+		}
+		CpuRelax();
+	}
+	// 没等到 -> 下次少自旋一会 但保留最大次数的1/16 以便负载变化后还能调回来
+	worker->spin = std::max(worker->spin / 2, m_idleSpin / 16);
+	return false;
+}
+
+void Scheduler::park()
+{
+	Worker* worker = localWorker();
+	assert(worker != nullptr);
+
+	// 之前已经被unpark()过 -> 消耗这次通知
+	int32_t state = kParkEmpty;
+	if(!worker->parkState.compare_exchange_strong(state, kParkWaiting))
+	{
+		worker->parkState = kParkEmpty;
+		return;
+	}
+	setParked(worker->index, true);
+
+	// 登记之后再检查一次 -> 提交任务时先入队再查找挂起的线程 -> 两者至少有一方能看到对方
+	if(worker->mailboxCount > 0 || hasStealableTasks() || stopping())
+	{
+		// 被唤醒者抢先(状态已不是kParkWaiting)时 它已经清除了挂起标记
+		state = kParkWaiting;
+		if(worker->parkState.compare_exchange_strong(state, kParkEmpty))
+		{
+			setParked(worker->index, false);
+		}
+		worker->parkState = kParkEmpty;
+		return;
+	}
+
+	while(worker->parkState == kParkWaiting)
+	{
+		if(!worker->elastic)
+		{
+			FutexWait(&worker->parkState, kParkWaiting);
+			continue;
+		}
+		// 弹性工作线程 -> 最多挂起到空闲超时 由idle()调用retire()退出
+		uint64_t now = NowMs();
+		uint64_t deadline = worker->lastBusy + m_retireAfter;
+		if(now < deadline)
+		{
+			FutexWait(&worker->parkState, kParkWaiting, deadline - now);
+			continue;
+		}
+		state = kParkWaiting;
+		if(worker->parkState.compare_exchange_strong(state, kParkEmpty))
+		{
+			setParked(worker->index, false);
+			return;
+		}
+	}
+	// 唤醒者已经清除了挂起标记
+	worker->parkState = kParkEmpty;
+}
+
+void Scheduler::setParked(size_t index, bool parked)
+{
+	uint64_t bit = 1ull << (index % 64);
+	if(parked)
+	{
+		m_parkedMask[index / 64].fetch_or(bit);
+	}
+	else
+	{
+		m_parkedMask[index / 64].fetch_and(~bit);
+	}
+}
+
+void Scheduler::unpark(size_t index)
+{
+	Worker* worker = m_workers[index].get();
+	if(worker->parkState.exchange(kParkNotified) == kParkWaiting)
+	{
+		setParked(index, false);
+		FutexWake(&worker->parkState);
+	}
+}
+
+bool Scheduler::unparkOne()
+{
+	size_t words = (m_workers.size() + 63) / 64;
+	for(size_t i=0;i<words;i++)
+	{
+		uint64_t mask = m_parkedMask[i].load();
+		while(mask)
+		{
+			uint64_t bit = mask & -mask;
+			mask &= mask - 1;
+			// 先清除标记 -> 清除成功的唤醒者负责唤醒它 其他唤醒者继续查找
+			if(!(m_parkedMask[i].fetch_and(~bit) & bit))
+			{
+				continue;
+			}
+			Worker* worker = m_workers[i * 64 + __builtin_ctzll(bit)].get();
+			int32_t state = kParkWaiting;
+			// 失败 -> 它已经自己取消了挂起(发现了任务或超时)
+			if(worker->parkState.compare_exchange_strong(state, kParkNotified))
+			{
+				FutexWake(&worker->parkState);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+Scheduler::ScheduleTask* Scheduler::NewTask(ScheduleTask&& task)
+{
+	void* p;
+	if(!t_task_nodes.nodes.empty())
+	{
+		p = t_task_nodes.nodes.back();
+		t_task_nodes.nodes.pop_back();
+	}
+	else
+	{
+		p = ::operator new(sizeof(ScheduleTask));
+	}
+	return new (p) ScheduleTask(std::move(task));
+}
+
+void Scheduler::FreeTask(ScheduleTask* task)
+{
+	task->~ScheduleTask();
+	// 被窃取的任务节点由窃取者缓存 -> 节点在线程间流动 但每个缓存只由所属线程访问
+	if(t_task_nodes.nodes.size() < kTaskCacheSize)
+	{
+		t_task_nodes.nodes.push_back(task);
+	}
+	else
+	{
+		::operator delete(task);
+	}
+}
+
+bool Scheduler::take(Worker* worker, ScheduleTask& task, bool& tickle_me)
+{
+	uint64_t tick = ++worker->tick;
+	// 老化 -> 每隔一定次数先取较低优先级的任务 其余按优先级从高到低
+	int first = tick % kBackgroundFirstInterval == 0 ? BACKGROUND 
+		: tick % kNormalFirstInterval == 0 ? NORMAL : CRITICAL;
+	for(int i=-1;i<kPriorityCount;i++)
+	{
+		int priority = i < 0 ? first : i;
+		if(i == first)
+		{
+			continue;
+		}
+		// 信箱 -> 只能在本线程运行的任务优先
+		if(takePinned(worker, priority, task))
+		{
+			return true;
+		}
+		// 有截止时间的任务 -> 在同一优先级中最先运行
+		if(takeDeadline(priority, task, tickle_me))
+		{
+			return true;
+		}
+		// 调度组 -> 虚拟运行时间比默认组(不属于任何组的NORMAL任务)小时先运行组内的任务
+		SchedulingGroup* group = priority == NORMAL ? pickGroup() : nullptr;
+		SchedulingGroup* fallback = nullptr;
+		if(group && group != m_groups[0].get())
+		{
+			if(group->m_vruntime <= m_groups[0]->m_vruntime && takeGroup(group, task, tickle_me))
+			{
+				return true;
+			}
+			fallback = group;
+		}
+		else if(group && takeGroup(group, task, tickle_me))
+		{
+			return true;
+		}
+		// 每隔一定次数先检查全局队列 -> 本地队列一直有任务时 全局队列中的任务也不会饥饿
+		if(tick % kGlobalCheckInterval == 0 && takeGlobal(priority, task, tickle_me))
+		{
+			return true;
+		}
+		// 本地队列 -> 全局队列 -> 窃取其他线程的本地队列
+		if(takeLocal(worker, priority, task) || takeGlobal(priority, task, tickle_me) || steal(worker, priority, task))
+		{
+			return true;
+		}
+		// 默认组没有任务 -> 它的虚拟运行时间跟上 之后不会因为空闲期间落后而连续占用
+		if(fallback)
+		{
+			RaiseTo(m_groups[0]->m_vruntime, fallback->m_vruntime);
+			if(takeGroup(fallback, task, tickle_me))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool Scheduler::takeLocal(Worker* worker, int priority, ScheduleTask& task)
+{
+	WorkStealingQueue<ScheduleTask*>& queue = worker->queues[priority];
+	ScheduleTask* node;
+	// 本地队列默认后进先出(缓存更热) -> 每隔一定次数取最早放入的任务 -> 反复重新调度自己的协程不会饿死队列中的其他任务
+	bool ok = worker->tick % kLocalFifoInterval == 0 ? queue.steal(node) || queue.pop(node)
+		: queue.pop(node);
+	if(!ok)
+	{
+		return false;
+	}
+	task = std::move(*node);
+	FreeTask(node);
+	return true;
+}
+
+bool Scheduler::takeGlobal(int priority, ScheduleTask& task, bool& tickle_me)
+{
+	if(!m_injectQueues[priority].pop(task))
+	{
+		return false;
+	}
+	// 还有任务 -> 唤醒其他空闲线程
+	tickle_me = tickle_me || !m_injectQueues[priority].empty();
+	return true;
+}
+
+bool Scheduler::takeDeadline(int priority, ScheduleTask& task, bool& tickle_me)
+{
+	if(m_deadlineCount[priority] == 0)
+	{
+		return false;
+	}
+
+	auto later = [](const DeadlineTask& a, const DeadlineTask& b) {return LaterDeadline(a.task.deadline, a.seq, b.task.deadline, b.seq);};
+	uint64_t now = NowMs();
+	bool found = false;
+	// 已错过截止时间 需要降级或丢弃的任务 -> 在锁外处理
+	std::vector<ScheduleTask> missed;
+	{
+		std::lock_guard<std::mutex> lock(m_deadlineMutex);
+		std::vector<DeadlineTask>& heap = m_deadlineTasks[priority];
+		while(!heap.empty())
+		{
+			std::pop_heap(heap.begin(), heap.end(), later);
+			ScheduleTask t = std::move(heap.back().task);
+			heap.pop_back();
+			m_deadlineCount[priority]--;
+			if(t.deadline < now)
+			{
+				m_deadlineMisses++;
+			}
+			if(t.deadline >= now || m_deadlinePolicy == RUN_LATE)
+			{
+				task = std::move(t);
+				found = true;
+				break;
+			}
+			missed.push_back(std::move(t));
+		}
+		// 还有任务 -> 唤醒其他空闲线程
+		tickle_me = tickle_me || !heap.empty();
+	}
+
+	// 放入BACKGROUND的全局队列 由空闲线程分担 -> 只降级本次调度 task.priority保留原来的优先级
+	auto end = std::remove_if(missed.begin(), missed.end(), [this](const ScheduleTask& t) {return m_deadlinePolicy == DROP && t.cb;});
+	for(auto it = missed.begin(); it != end; ++it)
+	{
+		it->deadline = 0;
+		if(it->fiber)
+		{
+			it->fiber->setDeadline(0);
+		}
+	}
+	if(missed.begin() != end)
+	{
+		m_injectQueues[BACKGROUND].push(missed.begin(), end);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		size_t idle = m_idleThreadCount;
+		if(idle > 0)
+		{
+			tickleMany(std::min<size_t>(end - missed.begin(), idle));
+		}
+	}
+	return found;
+}
+
+bool Scheduler::takePinned(Worker* worker, int priority, ScheduleTask& task)
+{
+	if(worker->mailboxCount == 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(worker->mailboxMutex);
+	std::deque<ScheduleTask>& mailbox = worker->mailbox[priority];
+	if(mailbox.empty())
+	{
+		return false;
+	}
+	task = std::move(mailbox.front());
+	mailbox.pop_front();
+	worker->mailboxCount--;
+	assert(task.fiber||task.cb);
+	return true;
+}
+
+bool Scheduler::steal(Worker* worker, int priority, ScheduleTask& task)
+{
+	size_t n = m_workers.size();
+	if(n <= 1)
+	{
+		return false;
+	}
+
+	// 从随机的线程开始 -> 避免所有空闲线程同时窃取同一个线程
+	worker->seed = worker->seed * 1103515245 + 12345;
+	size_t start = (worker->seed >> 16) % n;
+	for(size_t i=0;i<n;i++)
+	{
+		Worker* victim = m_workers[(start + i) % n].get();
+		if(victim == worker)
+		{
+			continue;
+		}
+
+		// 与其他窃取者竞争失败时 队列中仍有任务 -> 重试几次
+		ScheduleTask* node;
+		WorkStealingQueue<ScheduleTask*>& queue = victim->queues[priority];
+		for(int retry=0;retry<3 && !queue.empty();retry++)
+		{
+			if(queue.steal(node))
+			{
+				task = std::move(*node);
+				FreeTask(node);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool Scheduler::handoff(const Fiber::ptr& target)
+{
+	Fiber* curr = Fiber::Current();
+	SharedStack* stack = target->getSharedStack();
+
+	// 只能在本调度器的任务协程中交接 -> 共享栈协程只能在所属线程上运行 且当前协程正在使用的共享栈不能换出
+	if(GetThis() != this || !t_task_fiber || curr == nullptr || curr == target.get()
+		|| (stack && (stack->getThreadId() != Thread::GetThreadId() || stack == curr->getSharedStack())))
+	{
+		scheduleLock(target);
+		return false;
+	}
+
+	// target在本线程的交接队列中 -> 取出直接运行
+	for(auto it = t_handoff_queue.begin(); it != t_handoff_queue.end(); ++it)
+	{
+		if(*it == target)
+		{
+			t_handoff_queue.erase(it);
+			break;
+		}
+	}
+
+	// 与run()一样 运行期间持有协程锁 -> 防止其他线程在上下文保存之前恢复它
+	// run()已持有t_task_fiber的锁 本线程之前交接时已加锁的不再重复加锁
+	bool locked = target.get() == t_task_fiber;
+	for(size_t i=0;!locked && i<t_handoff_locked.size();i++)
+	{
+		locked = t_handoff_locked[i] == target;
+	}
+	if(!locked)
+	{
+		target->m_mutex.lock();
+		t_handoff_locked.push_back(target);
+	}
+
+	// 当前协程放入交接队列 -> 由run()在本线程上恢复
+	t_handoff_queue.push_back(Fiber::ptr(curr));
+	curr->yieldTo(target.get());
+	return true;
+}
+
+void Scheduler::ReleaseHandoff()
+{
+	t_task_fiber = nullptr;
+	for(auto& f : t_handoff_locked)
+	{
+		f->m_mutex.unlock();
+	}
+	t_handoff_locked.clear();
+}
+
+void Scheduler::stop()
+{
+	if(debug) std::cout << "Schedule::stop() starts in thread: " << Thread::GetThreadId() << std::endl;
+	
+	if(stopping())
+	{
+		return;
+	}
+
+	m_stopping = true;	
+
+	// 先停止监控线程 -> 之后不再增加工作线程
+	if(m_monitor)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_monitorMutex);
+			m_monitorStop = true;
+		}
+		m_monitorCond.notify_one();
+		m_monitor->join();
+	}
+
+    if (m_useCaller) 
+    {
+        assert(GetThis() == this);
+    } 
+    else 
+    {
+        assert(GetThis() != this);
+    }
+	
+	for (size_t i = 0; i < m_workers.size(); i++) 
+	{
+		tickle();
+	}
+
+	if (m_schedulerFiber) 
+	{
+		tickle();
+	}
+
+	if(m_schedulerFiber)
+	{
+		m_schedulerFiber->resume();
+		if(debug) std::cout << "m_schedulerFiber ends in thread:" << Thread::GetThreadId() << std::endl;
+	}
+
+	std::vector<std::shared_ptr<Thread>> thrs;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		thrs.swap(m_threads);
+	}
+
+	for(auto &i : thrs)
+	{
+		if(i)
+		{
+			i->join();
+		}
+	}
+	if(debug) std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+}
+
+void Scheduler::tickle()
+{
+	// 没有挂起的线程 -> 空闲线程都在自旋 会自己发现任务
+	if(hasIdleThreads())
+	{
+		unparkOne();
+	}
+}
+
+void Scheduler::tickleWorker(size_t index)
+{
+	unpark(index);
+}
+
+void Scheduler::tickleMany(size_t count)
+{
+	for(size_t i=0;i<count;i++)
+	{
+		tickle();
+	}
+}
+
+void Scheduler::idle()
+{
+	while(!stopping())
+	{
+		if(retire())
+		{
+			return;
+		}
+		if(debug) std::cout << "Scheduler::idle(), parking in thread: " << Thread::GetThreadId() << std::endl;	
+		// 先自旋一会 -> 很快到来的任务不需要挂起和唤醒的系统调用
+		if(!spin())
+		{
+			park();
+		}
+		Fiber::Current()->yield();
+	}
+	// 唤醒下一个挂起的线程 -> 它也会发现可以关闭了
+	tickle();
+}
+
+bool Scheduler::stopping() 
+{
+    // 只读原子变量和无锁的队列长度 -> 每个工作线程挂起前都会调用 不竞争全局锁
+    if(!m_stopping || m_activeThreadCount != 0 || hasStealableTasks())
+    {
+    	return false;
+    }
+    for(auto& w : m_workers)
+    {
+    	if(w->mailboxCount != 0)
+    	{
+    		return false;
+    	}
+    }
+    return true;
 }
 
 
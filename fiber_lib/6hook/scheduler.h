@@ -4,20 +4,113 @@
 #include "hook.h"
 #include "fiber.h"
 #include "thread.h"
+#include "shared_stack.h"
+#include "work_stealing_queue.h"
+#include "mpmc_queue.h"
+#include "cpu_topology.h"
 
 #include <mutex>
+#include <condition_variable>
+#include <ostream>
 #include <vector>
+#include <deque>
+#include <iterator>
+#include <type_traits>
 
 namespace sylar {
 
+// 工作线程的CPU绑定策略
+// 绑定后线程自己分配的内存(协程栈/本地队列)按首次访问落在本地NUMA节点上 工作线程的状态也分配在该节点上
+// use_caller时主线程(0号工作线程)是调用者的线程 不绑定
+struct Placement
+{
+	enum Policy
+	{
+		// 不绑定
+		NONE,
+		// 每个工作线程绑定到一个逻辑CPU -> 先用完每个物理核的第一个超线程再用第二个 同一NUMA节点的CPU相邻
+		CPU,
+		// 所有工作线程绑定到同一组CPU -> 由内核在组内调度
+		CPUSET,
+		// 每个工作线程绑定到一个物理核(包括它的所有超线程) -> 轮流使用每个NUMA节点的物理核
+		PHYSICAL_CORE
+	};
+
+	Policy policy = NONE;
+	// 可用的CPU -> 为空时为进程允许使用的所有CPU 工作线程多于可用的CPU/物理核时循环使用
+	std::vector<int> cpus;
+
+	Placement() {}
+	Placement(Policy p, const std::vector<int>& c = {}): policy(p), cpus(c) {}
+};
+
+class SchedulingGroup;
+
 class Scheduler
 {
+	friend class SchedulingGroup;
 public:
-	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler");
+	// 任务的优先级 -> 值越小越优先
+	// 按优先级从高到低取任务 每隔一定次数先取较低优先级的任务(老化) -> 低优先级的任务不会饿死
+	enum Priority
+	{
+		// 控制面/健康检查
+		CRITICAL = 0,
+		NORMAL = 1,
+		// 批量/后台任务
+		BACKGROUND = 2
+	};
+	static const int kPriorityCount = 3;
+	static_assert(NORMAL == Fiber::kDefaultPriority, "Fiber::kDefaultPriority must be Scheduler::NORMAL");
+
+	// 错过截止时间的任务的处理
+	enum DeadlinePolicy
+	{
+		// 照常按截止时间顺序运行
+		RUN_LATE,
+		// 本次调度降为BACKGROUND优先级 不再有截止时间 -> 协程自己的优先级不变
+		DEMOTE,
+		// 回调任务直接丢弃 -> 协程不能丢弃(挂起的调用者永远不会返回) 按DEMOTE处理
+		DROP
+	};
+
+	// max_threads大于threads时为弹性线程池:
+	// 没有空闲线程且全局队列/本地队列中的任务等待超过setGrowAfter()时 由监控线程增加一个工作线程 直到max_threads个
+	// 增加的工作线程空闲超过setRetireAfter()后退出 -> 初始的threads个工作线程一直运行
+	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler", const Placement& placement = Placement(), size_t max_threads = 0);
 	virtual ~Scheduler();
 	
 	const std::string& getName() const {return m_name;}
 
+	// 输出每个优先级的队列长度 每个工作线程绑定的CPU/NUMA节点 最近一次所在的CPU和队列长度
+	void dump(std::ostream& os);
+	// 优先级为priority的等待中的任务数(全局队列+本地队列+信箱) -> 近似值
+	size_t getQueueDepth(int priority);
+
+	// 创建公平调度组 -> 见SchedulingGroup 最多kMaxGroups个(包括默认组) 用完时返回nullptr
+	static const size_t kMaxGroups = 64;
+	SchedulingGroup* createGroup(const std::string& name, uint32_t weight = 1);
+	// 默认组 -> 不属于任何组的NORMAL任务计入默认组 可以调整它的权重
+	SchedulingGroup* getDefaultGroup() const {return m_groups[0].get();}
+
+	// 错过截止时间时的处理(默认RUN_LATE) / 已错过截止时间的任务数
+	void setDeadlinePolicy(DeadlinePolicy policy) {m_deadlinePolicy = policy;}
+	uint64_t getDeadlineMisses() const {return m_deadlineMisses;}
+
+	// 按栈高水位统计(StackProfiler)为回调任务选择栈大小 -> 样本不足的任务仍使用默认大小
+	void setStackAutoSizing(bool v) {m_stackAutoSizing = v;}
+
+	// 空闲线程挂起前自旋检查任务的最大次数 -> 0表示不自旋 直接挂起
+	// 每个线程的实际次数在[0, spins]之间自适应: 自旋期间等到任务时加倍 没等到时减半
+	static const uint32_t kDefaultIdleSpin = 1000;
+	void setIdleSpin(uint32_t spins) {m_idleSpin = spins;}
+
+	// 弹性线程池: 所有线程持续忙碌多久后增加线程 / 增加的线程空闲多久后退出(毫秒)
+	static const uint64_t kDefaultGrowAfter   = 10;
+	static const uint64_t kDefaultRetireAfter = 5000;
+	void setGrowAfter(uint64_t ms) {m_growAfter = ms;}
+	void setRetireAfter(uint64_t ms) {m_retireAfter = ms;}
+
 public:	
 	// 获取正在运行的调度器
 	static Scheduler* GetThis();
@@ -28,28 +121,100 @@ protected:
 	
 public:	
 	// 添加任务到任务队列
+	// 本调度器的工作线程提交的未指定线程的任务 -> 放入该线程的本地队列 空闲线程可以窃取
+	// 其他线程提交的未指定线程的任务 -> 放入无锁的全局队列
+	// 指定了线程的任务 -> 放入该线程的信箱 只唤醒该线程
+	// priority为-1时 -> 协程沿用自己的优先级 回调为NORMAL
+	// 指定的优先级只对本次调度有效 -> 协程之后被重新调度时仍使用自己的优先级(Fiber::setPriority())
     template <class FiberOrCb>
-    void scheduleLock(FiberOrCb fc, int thread = -1) 
+    void scheduleLock(FiberOrCb fc, int thread = -1, int priority = -1) 
     {
-    	bool need_tickle;
-    	{
-    		std::lock_guard<std::mutex> lock(m_mutex);
-    		// empty ->  all thread is idle -> need to be waken up
-    		need_tickle = m_tasks.empty();
-	        
-	        ScheduleTask task(fc, thread);
-	        if (task.fiber || task.cb) 
-	        {
-	            m_tasks.push_back(task);
-	        }
-    	}
-    	
-    	if(need_tickle)
-    	{
-    		tickle();
-    	}
+        ScheduleTask task(std::move(fc), thread, priority);
+        if (!task.fiber && !task.cb) 
+        {
+            return;
+        }
+
+        if (task.thread != -1 && schedulePinned(task.thread, &task, 1)) 
+        {
+            return;
+        }
+
+        if (task.deadline) 
+        {
+            pushDeadline(&task, 1);
+        }
+        else if (task.group && task.priority == NORMAL) 
+        {
+            pushGroup(&task, 1);
+        }
+        else if (Worker* worker = localWorker()) 
+        {
+            worker->queues[task.priority].push(NewTask(std::move(task)));
+        }
+        else
+        {
+            m_injectQueues[task.priority].push(std::move(task));
+        }
+
+        // 先入队再检查空闲线程 -> 与run()中先登记空闲再检查队列配对
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(hasIdleThreads())
+        {
+            tickle();
+        }
+    }
+
+	// 批量添加任务 -> [first, last)中的元素被移动到任务队列
+	// 整批只操作一次信箱/本地队列/全局队列 按任务数唤醒空闲线程(不超过空闲线程数)
+    template <class InputIt>
+    void scheduleBatch(InputIt first, InputIt last, int thread = -1, int priority = -1) 
+    {
+        std::vector<ScheduleTask> tasks;
+        if constexpr (std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<InputIt>::iterator_category>::value) 
+        {
+            tasks.reserve(std::distance(first, last));
+        }
+        for (; first != last; ++first) 
+        {
+            ScheduleTask task(std::move(*first), thread, priority);
+            if (!task.fiber && !task.cb) 
+            {
+                continue;
+            }
+            // 共享栈协程只能在所属线程运行 -> 单独放入该线程的信箱
+            if (task.thread != thread && schedulePinned(task.thread, &task, 1)) 
+            {
+                continue;
+            }
+            tasks.push_back(std::move(task));
+        }
+
+        if (tasks.empty() || (thread != -1 && schedulePinned(thread, tasks.data(), tasks.size()))) 
+        {
+            return;
+        }
+        scheduleUnpinned(tasks);
     }
 	
+	// 添加截止时间为从现在起timeout_ms毫秒的任务
+	// 有截止时间的任务放入所在优先级的截止时间堆 按截止时间从早到晚运行 在同一优先级中先于没有截止时间的任务
+	// -> 有截止时间的CRITICAL协程仍先于所有NORMAL任务 有截止时间的BACKGROUND任务不会越过NORMAL任务
+	// 协程运行后记住截止时间 之后被重新调度(IO就绪/定时器/唤醒)时沿用
+	void scheduleDeadline(Fiber::ptr fiber, uint64_t timeout_ms);
+	void scheduleDeadline(Callback cb, uint64_t timeout_ms);
+	// 设置当前协程的截止时间(从现在起timeout_ms毫秒 0为清除) -> 处理完有截止时间的请求后应清除
+	static void SetDeadline(uint64_t timeout_ms);
+
+	// 把回调放入调度组group的队列 -> 在协程外提交某个组的回调任务 group为nullptr时等同于scheduleLock(cb)
+	void scheduleGroup(SchedulingGroup* group, Callback cb);
+
+	// 从当前任务协程直接切换到target 当前协程放入本线程的交接队列 -> 一次切换 不经过全局锁和任务队列
+	// target必须是READY状态且没有在任务队列中(如等待被唤醒的协程 或本线程交接队列中的协程)
+	// 返回true -> 已切换 当前协程重新被调度后返回
+	// 返回false -> 不在任务协程中 或target的共享栈属于其他线程/正被当前协程占用 -> target按普通方式调度 当前协程继续运行
+	bool handoff(const Fiber::ptr& target);
+
 	// 启动线程池
 	virtual void start();
 	// 关闭线程池
@@ -57,6 +222,10 @@ public:
 	
 protected:
 	virtual void tickle();
+	// 唤醒指定序号的工作线程
+	virtual void tickleWorker(size_t index);
+	// 唤醒count个空闲线程 -> 默认调用count次tickle()
+	virtual void tickleMany(size_t count);
 	
 	// 线程函数
 	virtual void run();
@@ -69,43 +238,131 @@ protected:
 
 	bool hasIdleThreads() {return m_idleThreadCount>0;}
 
+	// 当前线程的工作线程序号 -> 不是本调度器的工作线程时返回-1
+	int getWorkerIndex() const;
+	// 工作线程的槽位数(包括弹性线程) -> 构造后不变
+	size_t getWorkerCount() const {return m_workers.size();}
+	// 当前工作线程的信箱中有任务
+	bool hasPinnedTasks() const;
+
+	// 自旋等待任务 -> 等到任务(或被unpark()过)时返回true
+	bool spin();
+	// 挂起当前工作线程 直到被unpark() -> 之前已经被unpark()过 或登记挂起后发现有任务/可以关闭时立即返回
+	void park();
+	// 唤醒指定序号的工作线程 -> 还没有挂起时 它下一次park()立即返回
+	void unpark(size_t index);
+	// 唤醒任意一个挂起的工作线程 -> 没有挂起的工作线程时返回false
+	bool unparkOne();
+	// 设置/清除工作线程的挂起标记
+	void setParked(size_t index, bool parked);
+	// 弹性线程池增加的工作线程空闲超过setRetireAfter()时 登记为退出并返回true -> idle()应随即返回 工作线程结束
+	bool retire();
+
+private:
+	// 释放交接过程中加的协程锁 -> run()重新获得执行权后调用
+	static void ReleaseHandoff();
+
+	struct ScheduleTask;
+	struct Worker;
+
+	// 创建worker的线程 -> 调用者持有m_mutex
+	void startWorker(Worker* worker);
+	// 弹性线程池的监控线程函数 / 启动一个未运行的弹性工作线程(已达到最大线程数时返回false)
+	void monitor();
+	bool grow();
+
+	// 当前线程对应的本调度器的工作线程 -> 不是本调度器的工作线程时返回nullptr
+	Worker* localWorker() const;
+	// 线程id对应的本调度器的工作线程 -> 不是本调度器的工作线程时返回nullptr
+	Worker* workerOf(int thread) const;
+
+	// 放入线程id对应的工作线程的信箱 只加一次锁 目标线程空闲时唤醒它
+	// 不是本调度器的工作线程时返回false -> 任务改为不指定线程(thread为-1) 其中有共享栈协程时终止进程
+	bool schedulePinned(int thread, ScheduleTask* tasks, size_t n);
+	// 任务改为不指定线程 -> 共享栈协程不能改 终止进程
+	static void Unpin(ScheduleTask* tasks, size_t n);
+	// 批量放入本地队列(本调度器的工作线程)或全局队列 有截止时间的任务放入截止时间堆 并唤醒空闲线程
+	void scheduleUnpinned(std::vector<ScheduleTask>& tasks);
+	// 放入截止时间堆 只加一次锁 -> 不唤醒空闲线程
+	void pushDeadline(ScheduleTask* tasks, size_t n);
+	// 放入所属调度组的队列 -> 只用于NORMAL的任务 不唤醒空闲线程
+	void pushGroup(ScheduleTask* tasks, size_t n);
+	// 全局队列或任意工作线程的本地队列中有任务
+	bool hasStealableTasks() const;
+
+	// 本地队列中的任务节点 -> 每个线程缓存一定数量的空闲节点 避免每个任务一次堆分配
+	static ScheduleTask* NewTask(ScheduleTask&& task);
+	static void FreeTask(ScheduleTask* task);
+
+	// 按优先级(含老化)取出一个任务 -> 每个优先级依次查找信箱/本地队列/全局队列/其他线程的本地队列
+	bool take(Worker* worker, ScheduleTask& task, bool& tickle_me);
+	bool takePinned(Worker* worker, int priority, ScheduleTask& task);
+	bool takeLocal(Worker* worker, int priority, ScheduleTask& task);
+	bool takeGlobal(int priority, ScheduleTask& task, bool& tickle_me);
+	bool steal(Worker* worker, int priority, ScheduleTask& task);
+	// 取出该优先级中截止时间最早的任务 -> 按m_deadlinePolicy处理已错过截止时间的任务
+	bool takeDeadline(int priority, ScheduleTask& task, bool& tickle_me);
+	// 有任务的调度组中虚拟运行时间最小的 -> 没有时返回nullptr
+	SchedulingGroup* pickGroup() const;
+	bool takeGroup(SchedulingGroup* group, ScheduleTask& task, bool& tickle_me);
+	// 按运行时长累加调度组的运行时间和虚拟运行时间
+	void charge(SchedulingGroup* group, uint64_t ns);
+
 private:
 	// 任务
 	struct ScheduleTask
 	{
-		std::shared_ptr<Fiber> fiber;
-		std::function<void()> cb;
+		Fiber::ptr fiber;
+		Callback cb;
 		int thread; // 指定任务需要运行的线程id
+		int priority; // 优先级 -> 队列的下标 (错过截止时间被降级的任务在BACKGROUND队列中 仍保留原来的优先级)
+		uint64_t deadline; // 截止时间 -> 0为没有
+		SchedulingGroup* group; // 调度组 -> nullptr为不属于任何组 只有NORMAL的任务进入组的队列
 
 		ScheduleTask()
 		{
 			fiber = nullptr;
 			cb = nullptr;
 			thread = -1;
+			priority = NORMAL;
+			deadline = 0;
+			group = nullptr;
 		}
 
-		ScheduleTask(std::shared_ptr<Fiber> f, int thr)
+		ScheduleTask(Fiber::ptr f, int thr, int prio = -1)
 		{
 			fiber = f;
-			thread = thr;
+			thread = Affinity(fiber, thr);
+			priority = Level(fiber, prio);
+			deadline = fiber ? fiber->getDeadline() : 0;
+			group = fiber ? fiber->getGroup() : nullptr;
 		}
 
-		ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
+		ScheduleTask(Fiber::ptr* f, int thr, int prio = -1)
 		{
 			fiber.swap(*f);
-			thread = thr;
+			thread = Affinity(fiber, thr);
+			priority = Level(fiber, prio);
+			deadline = fiber ? fiber->getDeadline() : 0;
+			group = fiber ? fiber->getGroup() : nullptr;
 		}	
 
-		ScheduleTask(std::function<void()> f, int thr)
+		ScheduleTask(Callback f, int thr, int prio = -1)
 		{
-			cb = f;
+			cb = std::move(f);
 			thread = thr;
+			priority = Level(nullptr, prio);
+			deadline = 0;
+			group = prio == -1 ? CurrentGroup() : nullptr;
 		}		
 
-		ScheduleTask(std::function<void()>* f, int thr)
+		ScheduleTask(Callback* f, int thr, int prio = -1)
 		{
 			cb.swap(*f);
 			thread = thr;
+			priority = Level(nullptr, prio);
+			deadline = 0;
+			group = prio == -1 ? CurrentGroup() : nullptr;
 		}
 
 		void reset()
@@ -113,17 +370,114 @@ private:
 			fiber = nullptr;
 			cb = nullptr;
 			thread = -1;
+			priority = NORMAL;
+			deadline = 0;
+			group = nullptr;
 		}	
+
+		// 未指定优先级的回调任务属于提交它的协程所在的调度组
+		static SchedulingGroup* CurrentGroup()
+		{
+			Fiber* f = Fiber::Current();
+			return f ? f->getGroup() : nullptr;
+		}
+
+		// 未指定(或无效)的优先级 -> 协程沿用自己的优先级 回调为NORMAL
+		static int Level(const Fiber::ptr& f, int prio)
+		{
+			if(prio >= 0 && prio < kPriorityCount)
+			{
+				return prio;
+			}
+			return f ? f->getPriority() : NORMAL;
+		}
+
+		// 共享栈协程只能在共享栈所属的线程上运行
+		static int Affinity(const Fiber::ptr& f, int thr)
+		{
+			if(f && f->getSharedStack())
+			{
+				return f->getSharedStack()->getThreadId();
+			}
+			return thr;
+		}
+	};
+
+	// 工作线程
+	struct Worker
+	{
+		// 序号 -> m_workers的下标
+		size_t index = 0;
+		// 线程id -> 线程启动后设置 弹性工作线程退出时重置为-1
+		std::atomic<int> threadId = {-1};
+		// 是否为弹性线程池增加的工作线程 / 线程是否在运行
+		bool elastic = false;
+		std::atomic<bool> running = {false};
+		// 最近一次执行完任务进入空闲的时间(毫秒) -> 弹性工作线程据此判断是否退出
+		uint64_t lastBusy = 0;
+		// 信箱 -> 指定在本线程运行的任务 每个优先级一个 由mailboxMutex保护
+		std::mutex mailboxMutex;
+		std::deque<ScheduleTask> mailbox[kPriorityCount];
+		// 信箱中的任务数(所有优先级) -> 不加锁判断是否为空
+		std::atomic<size_t> mailboxCount = {0};
+		// 是否空闲 -> 放入信箱的任务只在它空闲时才需要唤醒它
+		std::atomic<bool> idle = {false};
+		// 挂起状态(futex) -> kParkEmpty/kParkWaiting/kParkNotified 通过CAS转换 kParkWaiting期间在m_parkedMask中有标记
+		std::atomic<int32_t> parkState = {0};
+		// 当前的自旋次数
+		uint32_t spin = 0;
+		// 绑定的CPU和所在的NUMA节点(-1表示不绑定或跨节点)
+		std::vector<int> cpus;
+		int node = -1;
+		// 最近一次进入空闲时所在的CPU
+		std::atomic<int> cpu = {-1};
+		// 本地任务队列 -> 每个优先级一个
+		WorkStealingQueue<ScheduleTask*> queues[kPriorityCount];
+		// 调度次数 -> 每隔一定次数优先检查全局队列/从本地队列顶部取任务 -> 避免饥饿
+		uint64_t tick = 0;
+		// 窃取时选择起始线程的随机数
+		uint32_t seed = 0;
+
+		// 按页分配在所属的NUMA节点上 -> 也避免不同线程的状态共享缓存行
+		static void* operator new(size_t size, int node) {return CpuTopology::AllocateOnNode(size, node);}
+		static void operator delete(void* p, int /*node*/) {CpuTopology::FreeOnNode(p, sizeof(Worker));}
+		static void operator delete(void* p, size_t size) {CpuTopology::FreeOnNode(p, size);}
 	};
 
 private:
 	std::string m_name;
 	// 互斥锁 -> 保护任务队列
 	std::mutex m_mutex;
-	// 线程池
+	// 线程池 -> 下标为工作线程的序号(use_caller时减1) 未启动的弹性工作线程为空
 	std::vector<std::shared_ptr<Thread>> m_threads;
-	// 任务队列
-	std::vector<ScheduleTask> m_tasks;
+	// 全局任务队列 -> 其他线程提交的未指定线程的任务 每个优先级一个
+	MpmcQueue<ScheduleTask> m_injectQueues[kPriorityCount];
+	// 截止时间堆 -> 有截止时间的任务 每个优先级一个 按(截止时间, 放入顺序)的最小堆 由m_deadlineMutex保护
+	struct DeadlineTask
+	{
+		uint64_t seq;
+		ScheduleTask task;
+	};
+	std::mutex m_deadlineMutex;
+	std::vector<DeadlineTask> m_deadlineTasks[kPriorityCount];
+	uint64_t m_deadlineSeq = 0;
+	// 每个堆中的任务数 -> 不加锁判断是否为空
+	std::atomic<size_t> m_deadlineCount[kPriorityCount] = {};
+	DeadlinePolicy m_deadlinePolicy = RUN_LATE;
+	std::atomic<uint64_t> m_deadlineMisses = {0};
+	// 调度组 -> 0为默认组 只增加不删除 由m_groupMutex保护创建
+	std::unique_ptr<SchedulingGroup> m_groups[kMaxGroups];
+	std::atomic<size_t> m_groupCount = {0};
+	std::mutex m_groupMutex;
+	// 所有调度组队列中的任务数
+	std::atomic<size_t> m_groupedCount = {0};
+	// 有任务的组中最小的虚拟运行时间(近似 单调增加) -> 重新有任务的组从这里开始 不会因为之前空闲而连续占用
+	std::atomic<uint64_t> m_minVruntime = {0};
+	// 工作线程 -> 在构造函数中按最大线程数创建 之后不再改变 下标为工作线程的序号(use_caller时主线程为0)
+	// 未运行的弹性工作线程的队列为空 -> 窃取和检查队列时与其他线程一样遍历
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	// 挂起的工作线程 -> 每个工作线程一位 下标为序号
+	std::unique_ptr<std::atomic<uint64_t>[]> m_parkedMask;
 	// 存储工作线程的线程id
 	std::vector<int> m_threadIds;
 	// 需要额外创建的线程数
@@ -136,11 +490,59 @@ private:
 	// 主线程是否用作工作线程
 	bool m_useCaller;
 	// 如果是 -> 需要额外创建调度协程
-	std::shared_ptr<Fiber> m_schedulerFiber;
+	Fiber::ptr m_schedulerFiber;
 	// 如果是 -> 记录主线程的线程id
 	int m_rootThread = -1;
 	// 是否正在关闭
-	bool m_stopping = false;	
+	std::atomic<bool> m_stopping = {false};
+	// 是否按栈高水位统计选择任务协程的栈大小
+	bool m_stackAutoSizing = false;
+	// 空闲线程挂起前自旋的最大次数
+	uint32_t m_idleSpin = kDefaultIdleSpin;
+
+	// 弹性线程池
+	std::atomic<uint64_t> m_growAfter = {kDefaultGrowAfter};
+	std::atomic<uint64_t> m_retireAfter = {kDefaultRetireAfter};
+	// 监控线程 -> 有弹性工作线程时才创建
+	std::shared_ptr<Thread> m_monitor;
+	std::mutex m_monitorMutex;
+	std::condition_variable m_monitorCond;
+	bool m_monitorStop = false;
+};
+
+// 公平调度组(多租户隔离) -> 由Scheduler::createGroup()创建 与调度器的生命周期相同
+// 每个组有自己的任务队列 在NORMAL优先级中按权重分配运行时间:
+// 任务协程每次运行后 按运行时长/权重累加所属组的虚拟运行时间 -> 总是先运行虚拟运行时间最小的组(stride调度)
+// 协程属于创建它的协程所在的组(或Fiber::setGroup()设置的组) 协程中提交的未指定优先级的回调任务属于该协程所在的组
+// 只有NORMAL的任务参与公平调度 -> CRITICAL/BACKGROUND的任务仍放入对应优先级的队列 有截止时间的任务仍按截止时间调度
+class SchedulingGroup
+{
+public:
+	const std::string& getName() const {return m_name;}
+	uint32_t getWeight() const {return m_weight;}
+	void setWeight(uint32_t weight) {m_weight = weight ? weight : 1;}
+
+	// 组内任务累计的运行时间(纳秒) / 运行次数 / 等待中的任务数
+	uint64_t getRunTime() const {return m_runTime;}
+	uint64_t getRunCount() const {return m_runCount;}
+	size_t getQueueDepth() const {return m_count;}
+
+private:
+	friend class Scheduler;
+
+	SchedulingGroup(const std::string& name, uint32_t weight): m_name(name), m_weight(weight ? weight : 1) {}
+
+private:
+	std::string m_name;
+	std::atomic<uint32_t> m_weight;
+	std::atomic<uint64_t> m_runTime = {0};
+	std::atomic<uint64_t> m_runCount = {0};
+	// 虚拟运行时间
+	std::atomic<uint64_t> m_vruntime = {0};
+	// 等待中的任务 由m_mutex保护
+	std::mutex m_mutex;
+	std::deque<Scheduler::ScheduleTask> m_tasks;
+	std::atomic<size_t> m_count = {0};
 };
 
 }
@@ -0,0 +1,91 @@
+#include "shared_stack.h"
+#include "fiber.h"
+#include "stack_allocator.h"
+#include "thread.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace sylar {
+
+SharedStack::SharedStack(size_t size, StackAllocator* allocator)
+{
+	// 默认使用mmap栈 -> 按需提交物理页 且带保护页
+	m_allocator = allocator ? allocator : MmapStackAllocator::GetInstance();
+	m_size = size;
+	m_stack = m_allocator->allocate(m_size);
+	m_threadId = Thread::GetThreadId();
+	if(!m_stack)
+	{
+		std::cerr << "SharedStack() allocate stack failed\n";
+		pthread_exit(NULL);
+	}
+}
+
+SharedStack::~SharedStack()
+{
+	m_occupant.reset();
+	m_allocator->deallocate(m_stack, m_size);
+}
+
+void SharedStack::switchIn(Fiber* f)
+{
+	// 在其他线程上恢复会覆盖所属线程正在使用的栈 -> NDEBUG下同样检查
+	if(m_threadId != Thread::GetThreadId())
+	{
+		std::cerr << "SharedStack: fiber " << f->getId() << " resumed on thread " << Thread::GetThreadId() 
+				  << " but its shared stack belongs to thread " << m_threadId << std::endl;
+		abort();
+	}
+
+	if(m_occupant.get() == f && !f->m_needContext)
+	{
+		return;
+	}
+
+	// 已经结束的协程不需要保存
+	if(m_occupant && m_occupant.get() != f && m_occupant->getState() != Fiber::TERM)
+	{
+		m_occupant->saveStack();
+	}
+	m_occupant = Fiber::ptr(f);
+	f->restoreStack();
+}
+
+void SharedStack::release(Fiber* f)
+{
+	assert(m_threadId == Thread::GetThreadId() && f->getState() == Fiber::TERM);
+
+	free(f->m_saveBuffer);
+	f->m_saveBuffer = nullptr;
+	f->m_saveSize = 0;
+	f->m_saveCapacity = 0;
+	// 可能是最后一个引用 -> 最后释放
+	if(m_occupant.get() == f)
+	{
+		m_occupant.reset();
+	}
+}
+
+// 每个线程的共享栈 -> 第一次使用时创建
+static thread_local std::vector<std::unique_ptr<SharedStack>> t_stacks;
+static thread_local size_t t_next = 0;
+
+SharedStack* SharedStack::Next()
+{
+	if(t_stacks.empty())
+	{
+		for(size_t i=0;i<kCount;i++)
+		{
+			t_stacks.emplace_back(new SharedStack(kSize));
+		}
+	}
+	return t_stacks[t_next++ % kCount].get();
+}
+
+size_t SharedStack::Count()
+{
+	return t_stacks.size();
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef _SHARED_STACK_H_
+#define _SHARED_STACK_H_
+
+#include <memory>
+#include <unistd.h>
+
+#include "fiber.h"
+
+namespace sylar {
+
+class StackAllocator;
+
+// 共享栈(参考libco)
+// 同一线程上的多个协程轮流在一块大栈上运行 -> 切换到另一个协程前 把当前占用者实际用到的部分拷贝到它自己的保存缓冲区
+// 适合大量长期挂起且栈很浅的协程(长轮询/websocket连接) -> 每个挂起的协程只占用与实际栈深度相当的内存
+// 共享栈属于创建它的线程 -> 使用共享栈的协程只会被调度到该线程上
+class SharedStack
+{
+public:
+	// 每个线程的共享栈数量和大小
+	static const size_t kCount = 4;
+	static const size_t kSize  = 1024 * 1024;
+
+	SharedStack(size_t size, StackAllocator* allocator = nullptr);
+	~SharedStack();
+
+	void* getStack() const {return m_stack;}
+	size_t getSize() const {return m_size;}
+	StackAllocator* getAllocator() const {return m_allocator;}
+	pid_t getThreadId() const {return m_threadId;}
+
+	// 在resume()中 切换到f之前调用 -> 保存当前占用者的栈 恢复f的栈
+	void switchIn(Fiber* f);
+	// 协程f结束后调用(已不在共享栈上运行) -> 释放它的保存缓冲区 是当前占用者时不再持有它
+	void release(Fiber* f);
+
+public:
+	// 当前线程的下一个共享栈(轮询)
+	static SharedStack* Next();
+	// 当前线程已创建的共享栈数量 -> 不为0时线程退出会丢失挂起在共享栈上的协程
+	static size_t Count();
+
+private:
+	void* m_stack = nullptr;
+	size_t m_size = 0;
+	StackAllocator* m_allocator = nullptr;
+	// 所属线程
+	pid_t m_threadId = -1;
+	// 当前占用者 -> 持有引用 保证保存栈内容时协程对象仍然存在 结束后由release()释放
+	Fiber::ptr m_occupant;
+};
+
+}
+
+#endif
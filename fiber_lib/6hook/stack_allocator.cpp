@@ -0,0 +1,244 @@
+#include "stack_allocator.h"
+#include "cpu_topology.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace sylar {
+
+namespace {
+
+// 全局空闲链表
+struct GlobalCache
+{
+	std::mutex mutex;
+	std::vector<void*> stacks[StackPool::kClassCount];
+};
+
+// 每个NUMA节点一个全局链表 -> 线程归还/取回时使用它当前所在节点的链表 栈不会在节点之间流动
+GlobalCache& GetGlobalCache()
+{
+	// 不析构 -> 线程退出时仍可安全归还
+	static const int s_nodes = CpuTopology::GetInstance().getNodeCount();
+	static GlobalCache* s_caches = new GlobalCache[s_nodes];
+	return s_nodes == 1 ? s_caches[0] : s_caches[CpuTopology::CurrentNode() % s_nodes];
+}
+
+size_t ClassSize(int cls)
+{
+	return StackPool::kMinClassSize << cls;
+}
+
+size_t ThreadCacheLimit(int cls)
+{
+	size_t n = StackPool::kThreadCacheBytes / ClassSize(cls);
+	return n < 2 ? 2 : n;
+}
+
+size_t GlobalCacheLimit(int cls)
+{
+	return StackPool::kGlobalCacheBytes / ClassSize(cls);
+}
+
+// 线程缓存
+struct ThreadCache
+{
+	std::vector<void*> stacks[StackPool::kClassCount];
+
+	~ThreadCache();
+
+	// 把最久未使用的栈(头部)批量放回全局链表 -> 全局链表满了则释放
+	void spill(int cls, size_t keep)
+	{
+		std::vector<void*>& local = stacks[cls];
+		if(local.size() <= keep)
+		{
+			return;
+		}
+		size_t n = local.size() - keep;
+		size_t i = 0;
+
+		GlobalCache& global = GetGlobalCache();
+		{
+			std::lock_guard<std::mutex> lock(global.mutex);
+			for(;i<n && global.stacks[cls].size() < GlobalCacheLimit(cls);i++)
+			{
+				global.stacks[cls].push_back(local[i]);
+			}
+		}
+		for(;i<n;i++)
+		{
+			free(local[i]);
+		}
+		local.erase(local.begin(), local.begin() + n);
+	}
+
+	// 从全局链表批量取回
+	void refill(int cls)
+	{
+		std::vector<void*>& local = stacks[cls];
+		GlobalCache& global = GetGlobalCache();
+		std::lock_guard<std::mutex> lock(global.mutex);
+		size_t n = ThreadCacheLimit(cls) / 2;
+		while(n-- > 0 && !global.stacks[cls].empty())
+		{
+			local.push_back(global.stacks[cls].back());
+			global.stacks[cls].pop_back();
+		}
+	}
+};
+
+// 线程退出后 协程对象仍可能在其他thread_local的析构中被释放 -> 通过标记绕过已析构的线程缓存
+static thread_local bool t_cache_destroyed = false;
+static thread_local ThreadCache t_cache;
+
+ThreadCache::~ThreadCache()
+{
+	for(size_t i=0;i<StackPool::kClassCount;i++)
+	{
+		spill(i, 0);
+	}
+	t_cache_destroyed = true;
+}
+
+} // end anonymous namespace
+
+static std::atomic<StackAllocator*> s_default_allocator{nullptr};
+
+StackAllocator* StackAllocator::GetDefault()
+{
+	StackAllocator* allocator = s_default_allocator.load(std::memory_order_acquire);
+	return allocator ? allocator : StackPool::GetInstance();
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator)
+{
+	s_default_allocator.store(allocator, std::memory_order_release);
+}
+
+StackPool* StackPool::GetInstance()
+{
+	static StackPool* s_pool = new StackPool();
+	return s_pool;
+}
+
+int StackPool::SizeClass(size_t size)
+{
+	if(size > kMaxClassSize)
+	{
+		return -1;
+	}
+	int cls = 0;
+	while(ClassSize(cls) < size)
+	{
+		cls++;
+	}
+	return cls;
+}
+
+void* StackPool::Allocate(size_t& size)
+{
+	int cls = SizeClass(size);
+	if(cls < 0)
+	{
+		return malloc(size);
+	}
+	size = ClassSize(cls);
+
+	if(!t_cache_destroyed)
+	{
+		std::vector<void*>& local = t_cache.stacks[cls];
+		if(local.empty())
+		{
+			t_cache.refill(cls);
+		}
+		if(!local.empty())
+		{
+			void* stack = local.back();
+			local.pop_back();
+			return stack;
+		}
+	}
+	return malloc(size);
+}
+
+void StackPool::Deallocate(void* stack, size_t size)
+{
+	int cls = SizeClass(size);
+	if(cls < 0)
+	{
+		free(stack);
+		return;
+	}
+
+	if(t_cache_destroyed)
+	{
+		GlobalCache& global = GetGlobalCache();
+		{
+			std::lock_guard<std::mutex> lock(global.mutex);
+			if(global.stacks[cls].size() < GlobalCacheLimit(cls))
+			{
+				global.stacks[cls].push_back(stack);
+				return;
+			}
+		}
+		free(stack);
+		return;
+	}
+
+	// 最近归还的栈放在末尾 -> 下次优先复用 -> cache/TLB中仍是热的
+	std::vector<void*>& local = t_cache.stacks[cls];
+	local.push_back(stack);
+	if(local.size() > ThreadCacheLimit(cls))
+	{
+		t_cache.spill(cls, ThreadCacheLimit(cls) / 2);
+	}
+}
+
+MmapStackAllocator::MmapStackAllocator(size_t guard_pages)
+{
+	m_pageSize  = sysconf(_SC_PAGESIZE);
+	m_guardSize = guard_pages * m_pageSize;
+}
+
+MmapStackAllocator* MmapStackAllocator::GetInstance()
+{
+	static MmapStackAllocator* s_allocator = new MmapStackAllocator();
+	return s_allocator;
+}
+
+void* MmapStackAllocator::allocate(size_t& size)
+{
+	// 按页对齐
+	size = (size + m_pageSize - 1) & ~(m_pageSize - 1);
+
+	// MAP_NORESERVE -> 只预留地址空间 不预先占用swap
+	void* base = mmap(nullptr, size + m_guardSize, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if(base == MAP_FAILED)
+	{
+		std::cerr << "MmapStackAllocator::allocate() mmap failed, size = " << size << std::endl;
+		return nullptr;
+	}
+
+	// 栈向低地址增长 -> 保护页放在最低处
+	if(m_guardSize && mprotect(base, m_guardSize, PROT_NONE))
+	{
+		std::cerr << "MmapStackAllocator::allocate() mprotect failed" << std::endl;
+		munmap(base, size + m_guardSize);
+		return nullptr;
+	}
+	return (char*)base + m_guardSize;
+}
+
+void MmapStackAllocator::deallocate(void* stack, size_t size)
+{
+	munmap((char*)stack - m_guardSize, size + m_guardSize);
+}
+
+}
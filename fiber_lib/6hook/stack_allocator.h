@@ -0,0 +1,82 @@
+#ifndef _STACK_ALLOCATOR_H_
+#define _STACK_ALLOCATOR_H_
+
+#include <cstddef>
+
+namespace sylar {
+
+// 协程栈分配器接口
+class StackAllocator
+{
+public:
+	virtual ~StackAllocator() {}
+
+	// 申请协程栈 -> 返回栈的低地址 size可能被向上取整
+	virtual void* allocate(size_t& size) = 0;
+	// 归还协程栈 -> size为allocate()返回的大小
+	virtual void deallocate(void* stack, size_t size) = 0;
+
+	// 栈低地址下方保护页的大小 -> 0表示没有保护页
+	virtual size_t guardSize() const {return 0;}
+
+public:
+	// 默认分配器(未设置时为栈池)
+	static StackAllocator* GetDefault();
+	static void SetDefault(StackAllocator* allocator);
+};
+
+// 协程栈池
+// 每个线程缓存一定数量的空闲栈(按大小等级) -> 超出上限的栈溢出到全局空闲链表 -> 全局链表也满了才真正释放
+// 线程缓存为空时先从全局链表批量取回 -> 仍不够才malloc
+class StackPool : public StackAllocator
+{
+public:
+	// 大小等级: 16K 32K 64K 128K 256K 512K 1M
+	static const size_t kMinClassSize = 16 * 1024;
+	static const size_t kClassCount   = 7;
+	static const size_t kMaxClassSize = kMinClassSize << (kClassCount - 1);
+
+	// 每个线程每个等级最多缓存的字节数
+	static const size_t kThreadCacheBytes = 2 * 1024 * 1024;
+	// 全局链表每个等级最多缓存的字节数
+	static const size_t kGlobalCacheBytes = 32 * 1024 * 1024;
+
+	void* allocate(size_t& size) override {return Allocate(size);}
+	void deallocate(void* stack, size_t size) override {Deallocate(stack, size);}
+
+public:
+	static StackPool* GetInstance();
+
+	// 申请协程栈 -> size会被向上取整到所属的大小等级
+	static void* Allocate(size_t& size);
+	// 归还协程栈 -> size为Allocate()返回的大小
+	static void Deallocate(void* stack, size_t size);
+
+	// 大小等级 超过最大等级时返回-1
+	static int SizeClass(size_t size);
+};
+
+// mmap协程栈
+// 预留虚拟地址 -> 物理页由内核在首次访问时按需提交 -> 只用到8K的协程只占8K的RSS
+// 栈的低地址下方是PROT_NONE保护页 -> 栈溢出时触发SIGSEGV并报告协程id 而不是悄悄破坏堆
+class MmapStackAllocator : public StackAllocator
+{
+public:
+	explicit MmapStackAllocator(size_t guard_pages = 1);
+
+	void* allocate(size_t& size) override;
+	void deallocate(void* stack, size_t size) override;
+
+	size_t guardSize() const override {return m_guardSize;}
+
+public:
+	static MmapStackAllocator* GetInstance();
+
+private:
+	size_t m_pageSize;
+	size_t m_guardSize;
+};
+
+}
+
+#endif
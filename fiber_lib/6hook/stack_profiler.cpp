@@ -0,0 +1,224 @@
+#include "stack_profiler.h"
+#include "stack_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sylar {
+
+namespace {
+
+// 单个调用点的统计
+struct SiteStats
+{
+	std::string tag;
+	// 最近kMaxSamples个样本(环形)
+	std::vector<uint32_t> samples;
+	size_t next = 0;
+	uint64_t count = 0;
+	size_t max = 0;
+	// 缓存的建议值 -> 每kMinSamples个新样本重新计算一次
+	size_t recommended = 0;
+};
+
+struct Registry
+{
+	std::mutex mutex;
+	std::unordered_map<const void*, SiteStats> sites;
+	// 设置过标签的调用点 -> 标签
+	std::unordered_map<const void*, const void*> aliases;
+	// 任一建议值或别名变化时加1 -> 线程本地缓存据此失效
+	std::atomic<uint64_t> generation{0};
+};
+
+// Recommend()的线程本地缓存
+struct RecommendCache
+{
+	uint64_t generation = (uint64_t)-1;
+	std::unordered_map<const void*, size_t> values;
+};
+
+thread_local RecommendCache t_recommend_cache;
+
+Registry& GetRegistry()
+{
+	// 不析构 -> 线程退出时仍可记录
+	static Registry* s_registry = new Registry();
+	return *s_registry;
+}
+
+std::atomic<bool> s_enabled{false};
+
+size_t PercentileLocked(const SiteStats& stats, double p)
+{
+	if(stats.samples.empty())
+	{
+		return 0;
+	}
+	std::vector<uint32_t> sorted(stats.samples);
+	size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+	return sorted[idx];
+}
+
+// 调用点对应的统计 -> 设置过标签的调用点按标签查找
+const SiteStats* FindLocked(const Registry& registry, const void* site)
+{
+	auto alias = registry.aliases.find(site);
+	auto it = registry.sites.find(alias == registry.aliases.end() ? site : alias->second);
+	return it == registry.sites.end() ? nullptr : &it->second;
+}
+
+size_t RecommendLocked(const SiteStats& stats)
+{
+	if(stats.samples.size() < StackProfiler::kMinSamples)
+	{
+		return 0;
+	}
+	// 按最大值而不是分位数 -> 偶尔出现的深调用也有同样的余量
+	size_t need = std::max(StackProfiler::kMultiplier * stats.max, StackProfiler::kMinRecommend);
+	int cls = StackPool::SizeClass(need);
+	if(cls < 0)
+	{
+		return 0;
+	}
+	return StackPool::kMinClassSize << cls;
+}
+
+} // end anonymous namespace
+
+void StackProfiler::SetEnabled(bool enabled)
+{
+	s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool StackProfiler::IsEnabled()
+{
+	return s_enabled.load(std::memory_order_relaxed);
+}
+
+void StackProfiler::Paint(void* stack, size_t size)
+{
+	uint64_t* p = (uint64_t*)stack;
+	uint64_t* end = p + size / sizeof(uint64_t);
+	std::fill(p, end, kPaint);
+}
+
+size_t StackProfiler::HighWaterMark(const void* stack, size_t size)
+{
+	// 栈向低地址增长 -> 低地址处仍为哨兵值的部分从未被使用
+	const uint64_t* p = (const uint64_t*)stack;
+	const uint64_t* end = p + size / sizeof(uint64_t);
+	while(p < end && *p == kPaint)
+	{
+		p++;
+	}
+	return (const char*)stack + size - (const char*)p;
+}
+
+void StackProfiler::Record(const void* site, const char* tag, size_t used)
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	if(tag)
+	{
+		const void*& alias = registry.aliases[site];
+		if(alias != tag)
+		{
+			alias = tag;
+			registry.generation++;
+		}
+	}
+	SiteStats& stats = registry.sites[tag ? (const void*)tag : site];
+	if(tag && stats.tag.empty())
+	{
+		stats.tag = tag;
+	}
+
+	if(stats.samples.size() < kMaxSamples)
+	{
+		stats.samples.push_back(used);
+	}
+	else
+	{
+		stats.samples[stats.next] = used;
+		stats.next = (stats.next + 1) % kMaxSamples;
+	}
+	stats.count++;
+	stats.max = std::max(stats.max, used);
+
+	// 出现更深的栈时立即更新 -> 避免缓存的建议值偏小
+	if(stats.count % kMinSamples == 0 || (stats.recommended && used * kMultiplier > stats.recommended))
+	{
+		size_t recommended = RecommendLocked(stats);
+		if(recommended != stats.recommended)
+		{
+			stats.recommended = recommended;
+			registry.generation++;
+		}
+	}
+}
+
+size_t StackProfiler::Percentile(const void* site, double p)
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	const SiteStats* stats = FindLocked(registry, site);
+	return stats ? PercentileLocked(*stats, p) : 0;
+}
+
+size_t StackProfiler::Recommend(const void* site)
+{
+	Registry& registry = GetRegistry();
+	RecommendCache& cache = t_recommend_cache;
+	uint64_t generation = registry.generation.load(std::memory_order_acquire);
+	if(cache.generation != generation)
+	{
+		cache.values.clear();
+		cache.generation = generation;
+	}
+	auto it = cache.values.find(site);
+	if(it != cache.values.end())
+	{
+		return it->second;
+	}
+
+	size_t recommended;
+	{
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		const SiteStats* stats = FindLocked(registry, site);
+		recommended = stats ? stats->recommended : 0;
+	}
+	cache.values[site] = recommended;
+	return recommended;
+}
+
+void StackProfiler::Dump(std::ostream& os)
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for(auto& i : registry.sites)
+	{
+		const SiteStats& stats = i.second;
+		os << "site = ";
+		if(stats.tag.empty())
+		{
+			os << i.first;
+		}
+		else
+		{
+			os << stats.tag;
+		}
+		os << ", samples = " << stats.count
+		   << ", p50 = " << PercentileLocked(stats, 50)
+		   << ", p99 = " << PercentileLocked(stats, 99)
+		   << ", max = " << stats.max
+		   << ", recommended = " << stats.recommended << std::endl;
+	}
+}
+
+}
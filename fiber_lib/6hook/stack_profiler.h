@@ -0,0 +1,53 @@
+#ifndef _STACK_PROFILER_H_
+#define _STACK_PROFILER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace sylar {
+
+// 协程栈高水位统计
+// 开启后新分配/复用的协程栈先用哨兵值填充 -> 协程结束时从栈底(低地址)向上找到第一个被改写的位置 -> 得到实际用到的最大栈深度
+// 结果按调用点(回调的类型标识)或协程标签汇总 -> 调度器据此为每类任务选择栈大小
+// 填充会提交整个栈的物理页 -> 只用于测量 不建议在生产环境长期开启
+class StackProfiler
+{
+public:
+	// 哨兵值
+	static constexpr uint64_t kPaint = 0xa5a5a5a5a5a5a5a5ULL;
+	// 每个调用点保留的最近样本数
+	static const size_t kMaxSamples = 1024;
+	// 样本数不足时不给出建议
+	static const size_t kMinSamples = 64;
+	// 建议栈大小的下限和相对最大样本的倍数 -> 栈池的栈没有保护页 之后比所有样本都深的调用不能直接溢出
+	static constexpr size_t kMinRecommend = 32 * 1024;
+	static constexpr size_t kMultiplier = 2;
+
+	// 开启/关闭统计 -> 只影响之后创建或复用的协程
+	static void SetEnabled(bool enabled);
+	static bool IsEnabled();
+
+	// 用哨兵值填充整个栈
+	static void Paint(void* stack, size_t size);
+	// 栈的高水位(字节) -> stack为栈的低地址
+	static size_t HighWaterMark(const void* stack, size_t size);
+
+	// 记录一次高水位 -> tag不为空时记在标签下 调用点记为该标签的别名
+	static void Record(const void* site, const char* tag, size_t used);
+
+	// 调用点(或标签)的p分位数(0~100) -> 没有样本时返回0
+	static size_t Percentile(const void* site, double p);
+
+	// 建议的栈大小 -> max(kMultiplier*最大值, kMinRecommend) 向上取整到栈池的大小等级
+	// 样本不足或超过最大等级时返回0 -> 使用默认栈大小
+	// 结果缓存在线程本地 建议值变化时整体失效 -> 调度器每个回调任务查询一次 不加全局锁
+	static size_t Recommend(const void* site);
+
+	// 输出所有调用点的统计
+	static void Dump(std::ostream& os);
+};
+
+}
+
+#endif
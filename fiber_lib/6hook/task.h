@@ -0,0 +1,459 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+
+// C++20无栈协程 -> 需要 -std=c++20
+// 协程帧在堆上按实际用到的局部变量分配 -> 适合大量并发、逻辑简单的任务(扇出请求) 比128K的有栈协程便宜得多
+// 与有栈协程共用同一个调度器和工作线程:
+// 1 Spawn()把任务放进调度器的任务队列 -> 工作线程在任务协程中恢复它
+// 2 挂起点(IO就绪/定时器/有栈协程)完成时 同样通过调度器调度回调来恢复 -> 恢复后可能运行在另一个工作线程上
+// 3 在无栈协程中可以co_await RunInFiber()把会阻塞的代码放到有栈协程中执行 在有栈协程中可以用BlockOn()等待无栈协程
+#if !defined(__cpp_impl_coroutine)
+#error "task.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <cassert>
+#include <cerrno>
+
+#include "ioscheduler.h"
+
+namespace sylar {
+
+template<class T = void>
+class Task;
+
+namespace detail {
+
+// 协程的返回值或异常
+template<class T>
+class TaskResult
+{
+public:
+	template<class U>
+	void setValue(U&& value) {m_value.emplace(std::forward<U>(value));}
+	void setException(std::exception_ptr e) {m_exception = e;}
+
+	T get()
+	{
+		if(m_exception)
+		{
+			std::rethrow_exception(m_exception);
+		}
+		return std::move(*m_value);
+	}
+
+private:
+	std::optional<T> m_value;
+	std::exception_ptr m_exception;
+};
+
+template<>
+class TaskResult<void>
+{
+public:
+	void setValue() {}
+	void setException(std::exception_ptr e) {m_exception = e;}
+
+	void get()
+	{
+		if(m_exception)
+		{
+			std::rethrow_exception(m_exception);
+		}
+	}
+
+private:
+	std::exception_ptr m_exception;
+};
+
+// 调度器中恢复协程的回调
+struct ResumeCallback
+{
+	std::coroutine_handle<> handle;
+
+	void operator()() const {handle.resume();}
+};
+
+class TaskPromiseBase
+{
+public:
+	// 结束时 -> 直接切换回等待者(对称转移) 没有等待者时停在final_suspend 由Task负责销毁
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept {return false;}
+
+		template<class Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+		{
+			std::coroutine_handle<> continuation = h.promise().m_continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	// 惰性启动 -> 被co_await或Spawn()时才开始运行
+	std::suspend_always initial_suspend() noexcept {return {};}
+	FinalAwaiter final_suspend() noexcept {return {};}
+
+	void setContinuation(std::coroutine_handle<> h) {m_continuation = h;}
+
+private:
+	std::coroutine_handle<> m_continuation;
+};
+
+template<class T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+	Task<T> get_return_object();
+
+	template<class U>
+	void return_value(U&& value) {m_result.setValue(std::forward<U>(value));}
+	void unhandled_exception() {m_result.setException(std::current_exception());}
+
+	T result() {return m_result.get();}
+
+private:
+	TaskResult<T> m_result;
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+	Task<void> get_return_object();
+
+	void return_void() {}
+	void unhandled_exception() {m_result.setException(std::current_exception());}
+
+	void result() {m_result.get();}
+
+private:
+	TaskResult<void> m_result;
+};
+
+// 分离的协程 -> 运行结束后自动销毁协程帧 未捕获的异常终止进程(与std::thread相同)
+struct DetachedTask
+{
+	struct promise_type
+	{
+		DetachedTask get_return_object() {return {std::coroutine_handle<promise_type>::from_promise(*this)};}
+		std::suspend_always initial_suspend() noexcept {return {};}
+		std::suspend_never final_suspend() noexcept {return {};}
+		void return_void() {}
+		void unhandled_exception() {std::terminate();}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+} // end namespace detail
+
+// 无栈协程任务
+// 惰性启动 -> co_await时在等待者的线程上开始运行 结束时直接切换回等待者
+// 只能移动 -> 析构时销毁协程帧 -> 不能在协程运行期间析构
+template<class T>
+class [[nodiscard]] Task
+{
+public:
+	typedef detail::TaskPromise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> handle_type;
+
+	struct Awaiter
+	{
+		handle_type handle;
+
+		// 空的Task(默认构造或已被移动)不能co_await
+		bool await_ready() const noexcept
+		{
+			assert(handle && "co_await on an empty Task");
+			return handle.done();
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			handle.promise().setContinuation(awaiting);
+			return handle;
+		}
+
+		T await_resume()
+		{
+			assert(handle);
+			return handle.promise().result();
+		}
+	};
+
+	Task() {}
+	explicit Task(handle_type h): m_handle(h) {}
+
+	Task(Task&& other) noexcept: m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if(this != &other)
+		{
+			if(m_handle)
+			{
+				m_handle.destroy();
+			}
+			m_handle = std::exchange(other.m_handle, nullptr);
+		}
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task()
+	{
+		if(m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	Awaiter operator co_await() const noexcept {return Awaiter{m_handle};}
+
+	bool done() const {return !m_handle || m_handle.done();}
+
+private:
+	handle_type m_handle;
+};
+
+namespace detail {
+
+template<class T>
+inline Task<T> TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+template<class T>
+DetachedTask RunDetached(Task<T> task)
+{
+	co_await task;
+}
+
+template<class T>
+DetachedTask RunAndNotify(Task<T> task, TaskResult<T>& result, Scheduler* scheduler, Fiber::ptr fiber)
+{
+	try
+	{
+		if constexpr (std::is_void<T>::value)
+		{
+			co_await task;
+			result.setValue();
+		}
+		else
+		{
+			result.setValue(co_await task);
+		}
+	}
+	catch(...)
+	{
+		result.setException(std::current_exception());
+	}
+	// 等待的有栈协程可能还没有让出 -> run()持有它的锁 会等它让出后再恢复
+	scheduler->scheduleLock(std::move(fiber));
+}
+
+} // end namespace detail
+
+// 把任务放进调度器的任务队列 -> 由工作线程开始运行 运行结束后自动销毁
+// thread不为-1时 在指定线程上开始运行
+template<class T>
+void Spawn(Scheduler* scheduler, Task<T> task, int thread = -1)
+{
+	detail::DetachedTask detached = detail::RunDetached(std::move(task));
+	scheduler->scheduleLock(Callback(detail::ResumeCallback{detached.handle}), thread);
+}
+
+// 在有栈协程中等待无栈协程 -> 当前协程让出 任务结束后被重新调度
+// 必须在调度器的任务协程中调用
+template<class T>
+T BlockOn(Task<T> task)
+{
+	Scheduler* scheduler = Scheduler::GetThis();
+	assert(scheduler != nullptr);
+
+	detail::TaskResult<T> result;
+	detail::DetachedTask detached = detail::RunAndNotify(std::move(task), result, scheduler, Fiber::GetThis());
+	// 在当前协程上运行到第一个挂起点
+	detached.handle.resume();
+	Fiber::Current()->yield();
+	return result.get();
+}
+
+// 等待fd上的事件就绪
+// 返回0 -> 就绪(或事件被cancelEvent()取消)
+// 返回-1 -> 注册事件失败 或超时(errno为ETIMEDOUT)
+// timeout_ms为-1时不超时
+class EventAwaiter
+{
+public:
+	EventAwaiter(int fd, IOManager::Event event, uint64_t timeout_ms = -1, IOManager* iom = IOManager::GetThis()):
+	m_iom(iom), m_fd(fd), m_event(event), m_timeout(timeout_ms)
+	{
+		assert(m_iom != nullptr);
+	}
+
+	bool await_ready() const noexcept {return false;}
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		// 与hook中的do_io相同 -> 超时时取消事件 事件的回调被触发从而恢复协程
+		if(m_timeout != (uint64_t)-1)
+		{
+			m_state = std::make_shared<TimeoutState>();
+			std::weak_ptr<TimeoutState> weak_state(m_state);
+			m_timer = m_iom->addConditionTimer(m_timeout, [weak_state, iom = m_iom, fd = m_fd, event = m_event]()
+			{
+				std::shared_ptr<TimeoutState> state = weak_state.lock();
+				if(!state || state->cancelled)
+				{
+					return;
+				}
+				state->cancelled = ETIMEDOUT;
+				iom->cancelEvent(fd, event);
+			}, weak_state);
+		}
+
+		if(m_iom->addEvent(m_fd, m_event, detail::ResumeCallback{h}))
+		{
+			if(m_timer)
+			{
+				m_timer->cancel();
+			}
+			m_result = -1;
+			return false;
+		}
+		// 注册成功后协程可能已经在其他线程上恢复 -> 不能再访问成员
+		return true;
+	}
+
+	int await_resume()
+	{
+		if(m_timer)
+		{
+			m_timer->cancel();
+		}
+		if(m_state && m_state->cancelled)
+		{
+			errno = m_state->cancelled;
+			return -1;
+		}
+		return m_result;
+	}
+
+private:
+	struct TimeoutState
+	{
+		int cancelled = 0;
+	};
+
+	IOManager* m_iom;
+	int m_fd;
+	IOManager::Event m_event;
+	uint64_t m_timeout;
+	int m_result = 0;
+	std::shared_ptr<TimeoutState> m_state;
+	std::shared_ptr<Timer> m_timer;
+};
+
+// 等待fd可读/可写
+inline EventAwaiter Readable(int fd, uint64_t timeout_ms = -1) {return EventAwaiter(fd, IOManager::READ, timeout_ms);}
+inline EventAwaiter Writable(int fd, uint64_t timeout_ms = -1) {return EventAwaiter(fd, IOManager::WRITE, timeout_ms);}
+
+// 挂起ms毫秒
+class SleepAwaiter
+{
+public:
+	explicit SleepAwaiter(uint64_t ms, TimerManager* timers = IOManager::GetThis()):
+	m_timers(timers), m_ms(ms)
+	{
+		assert(m_timers != nullptr);
+	}
+
+	bool await_ready() const noexcept {return false;}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		m_timers->addTimer(m_ms, detail::ResumeCallback{h});
+	}
+
+	void await_resume() const noexcept {}
+
+private:
+	TimerManager* m_timers;
+	uint64_t m_ms;
+};
+
+inline SleepAwaiter SleepFor(uint64_t ms) {return SleepAwaiter(ms);}
+
+// 在有栈协程中执行fn并等待其结束 -> fn中可以调用会阻塞的函数(被hook的sleep/recv等)
+// fn在调度器的任务协程中运行 结束后协程在同一个任务协程中恢复
+template<class F>
+class FiberAwaiter
+{
+public:
+	typedef std::invoke_result_t<F&> result_type;
+
+	FiberAwaiter(F fn, Scheduler* scheduler): m_fn(std::move(fn)), m_scheduler(scheduler)
+	{
+		assert(m_scheduler != nullptr);
+	}
+
+	bool await_ready() const noexcept {return false;}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		m_scheduler->scheduleLock(Callback([this, h]()
+		{
+			try
+			{
+				if constexpr (std::is_void<result_type>::value)
+				{
+					m_fn();
+					m_result.setValue();
+				}
+				else
+				{
+					m_result.setValue(m_fn());
+				}
+			}
+			catch(...)
+			{
+				m_result.setException(std::current_exception());
+			}
+			h.resume();
+		}));
+	}
+
+	result_type await_resume() {return m_result.get();}
+
+private:
+	F m_fn;
+	Scheduler* m_scheduler;
+	detail::TaskResult<result_type> m_result;
+};
+
+template<class F>
+FiberAwaiter<F> RunInFiber(F fn, Scheduler* scheduler = Scheduler::GetThis())
+{
+	return FiberAwaiter<F>(std::move(fn), scheduler);
+}
+
+}
+
+#endif
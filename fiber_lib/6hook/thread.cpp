@@ -1,6 +1,7 @@
 #include "thread.h"
 
 #include <sys/syscall.h> 
+#include <pthread.h>
 #include <iostream>
 #include <unistd.h>  
 
@@ -34,8 +35,25 @@ void Thread::SetName(const std::string &name)
     t_thread_name = name;
 }
 
-Thread::Thread(std::function<void()> cb, const std::string &name): 
-m_cb(cb), m_name(name) 
+bool Thread::SetAffinity(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) 
+    {
+        CPU_SET(cpu, &set);
+    }
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt) 
+    {
+        std::cerr << "pthread_setaffinity_np failed, rt=" << rt << " name=" << t_thread_name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Thread::Thread(std::function<void()> cb, const std::string &name, const std::vector<int>& cpus): 
+m_cb(cb), m_name(name), m_cpus(cpus) 
 {
     int rt = pthread_create(&m_thread, nullptr, &Thread::run, this);
     if (rt) 
@@ -79,6 +97,12 @@ void* Thread::run(void* arg)
     thread->m_id   = GetThreadId();
     pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
 
+    // 先绑定CPU -> 线程函数中分配的内存(协程栈等)按首次访问落在本地NUMA节点上
+    if (!thread->m_cpus.empty()) 
+    {
+        SetAffinity(thread->m_cpus);
+    }
+
     std::function<void()> cb;
     cb.swap(thread->m_cb); // swap -> 可以减少m_cb中只能指针的引用计数
     
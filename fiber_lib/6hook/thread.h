@@ -4,6 +4,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>     
+#include <vector>
 
 namespace sylar
 {
@@ -43,11 +44,13 @@ public:
 class Thread 
 {
 public:
-    Thread(std::function<void()> cb, const std::string& name);
+    // cpus不为空时 -> 线程函数运行之前把线程绑定到这组CPU上
+    Thread(std::function<void()> cb, const std::string& name, const std::vector<int>& cpus = {});
     ~Thread();
 
     pid_t getId() const { return m_id; }
     const std::string& getName() const { return m_name; }
+    const std::vector<int>& getCpus() const { return m_cpus; }
 
     void join();
 
@@ -61,6 +64,8 @@ public:
     static const std::string& GetName();
     // 设置当前线程的名字
     static void SetName(const std::string& name);
+    // 把当前线程绑定到cpus这组CPU上
+    static bool SetAffinity(const std::vector<int>& cpus);
 
 private:
 	// 线程函数
@@ -73,6 +78,8 @@ private:
     // 线程需要运行的函数
     std::function<void()> m_cb;
     std::string m_name;
+    // 绑定的CPU
+    std::vector<int> m_cpus;
     
     Semaphore m_semaphore;
 };
@@ -1,24 +1,419 @@
 #include "timer.h"
 
+#include <algorithm>
+
 namespace sylar {
 
-bool Timer::cancel() 
+typedef std::chrono::time_point<std::chrono::steady_clock> TimePoint;
+
+namespace {
+
+uint64_t FloorMs(TimePoint t)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+}
+
+uint64_t ToNs(TimePoint t)
 {
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+} // end anonymous namespace
+
+// 保存timer的数据结构 -> 所有操作都在TimerManager::m_mutex的保护下进行
+class TimerQueue
+{
+public:
+    virtual ~TimerQueue() {}
 
-    if(m_cb == nullptr) 
+    virtual void insert(const std::shared_ptr<Timer>& timer) = 0;
+    // timer不在其中时返回false
+    virtual bool erase(Timer* timer) = 0;
+    virtual bool empty() const = 0;
+    // 最早的超时时间 -> 可以比实际的早(调用者会多醒来一次) 不能比实际的晚 为空时不调用
+    virtual TimePoint next() const = 0;
+    // 取出超时时间<=now的timer
+    virtual void popExpired(TimePoint now, std::vector<std::shared_ptr<Timer>>& expired) = 0;
+};
+
+// 按超时时间排序的std::set
+class TimerSet : public TimerQueue
+{
+public:
+    void insert(const std::shared_ptr<Timer>& timer) override
     {
-        return false;
+        m_timers.insert(timer);
     }
-    else
+
+    bool erase(Timer* timer) override
+    {
+        auto it = m_timers.find(timer->shared_from_this());
+        if(it==m_timers.end())
+        {
+            return false;
+        }
+        m_timers.erase(it);
+        return true;
+    }
+
+    bool empty() const override {return m_timers.empty();}
+
+    TimePoint next() const override {return (*m_timers.begin())->m_next;}
+
+    void popExpired(TimePoint now, std::vector<std::shared_ptr<Timer>>& expired) override
+    {
+        while(!m_timers.empty() && (*m_timers.begin())->m_next <= now)
+        {
+            expired.push_back(*m_timers.begin());
+            m_timers.erase(m_timers.begin());
+        }
+    }
+
+private:
+    std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;
+};
+
+// 分层时间轮(参考Varghese & Lauck的hierarchical timing wheels)
+// 一个刻度为1ms 第0层256个槽位 往上4层每层64个槽位 上层的一个槽位覆盖下一层的一整圈 -> 共2^32ms(约49天) 更远的timer放在最高层
+// 每个槽位是timer的侵入式双向链表 -> 添加/删除只修改链表 O(1) 不需要分配
+// 时间推进到上层槽位的起点时 把该槽位中的timer按剩余时间重新放入下层(cascade)
+// 每个槽位用一位记录是否为空 -> 推进时间和求最早的超时时间时跳过空槽位
+class TimerWheel : public TimerQueue
+{
+public:
+    explicit TimerWheel(TimePoint now): m_current(FloorMs(now))
+    {
+        std::fill(m_slots, m_slots + kSlotCount, nullptr);
+        std::fill(m_bitmap, m_bitmap + kSlotCount / 64, 0);
+    }
+
+    ~TimerWheel()
+    {
+        // 释放timer对自身的引用
+        std::vector<std::shared_ptr<Timer>> timers;
+        takeAll(timers);
+    }
+
+    void insert(const std::shared_ptr<Timer>& timer) override
+    {
+        timer->m_self = timer;
+        place(timer.get());
+        m_size++;
+    }
+
+    bool erase(Timer* timer) override
+    {
+        if(timer->m_slot < 0)
+        {
+            return false;
+        }
+        std::shared_ptr<Timer> self = std::move(timer->m_self);
+        unlink(timer);
+        m_size--;
+        return true;
+    }
+
+    bool empty() const override {return m_size == 0;}
+
+    TimePoint next() const override
+    {
+        int slot;
+        TimePoint best(std::chrono::milliseconds(nextTick(&slot)));
+        if(slot >= 0)
+        {
+            // 最早的刻度在第0层 -> 取槽位中准确的超时时间 避免调用者在这一毫秒内空转
+            best = m_slots[slot]->m_next;
+            for(Timer* timer=m_slots[slot];timer;timer=timer->m_slotNext)
+            {
+                best = std::min(best, timer->m_next);
+            }
+        }
+        return best;
+    }
+
+    void popExpired(TimePoint now, std::vector<std::shared_ptr<Timer>>& expired) override
+    {
+        uint64_t tick = FloorMs(now);
+        while(true)
+        {
+            uint64_t t = m_current;
+            if((t & (kSlots0 - 1)) == 0)
+            {
+                cascade(t);
+            }
+
+            // 第0层的槽位中都是这一刻度(或更早)超时的timer -> 当前这一毫秒还要比较准确的超时时间
+            int slot = t & (kSlots0 - 1);
+            for(Timer* timer=m_slots[slot];timer;)
+            {
+                Timer* next = timer->m_slotNext;
+                if(t < tick || timer->m_next <= now)
+                {
+                    expired.push_back(std::move(timer->m_self));
+                    unlink(timer);
+                    m_size--;
+                }
+                timer = next;
+            }
+            // 停在当前这一毫秒 -> 之后加入的同一毫秒内的timer仍然放在这个槽位 下次再检查
+            if(t == tick)
+            {
+                break;
+            }
+
+            // 跳到下一个非空槽位 或第0层一圈的起点(需要cascade)
+            uint64_t next = t + 1;
+            if((next & (kSlots0 - 1)) != 0)
+            {
+                int i = findSlot(0, next & (kSlots0 - 1), kSlots0);
+                next = i >= 0 ? (next & ~(uint64_t)(kSlots0 - 1)) + i : (t | (kSlots0 - 1)) + 1;
+            }
+            m_current = std::min(next, tick);
+        }
+    }
+
+private:
+    static const int kLevels = 5;
+    static const int kSlots0 = 256;
+    static const int kSlots = 64;
+    static const int kSlotCount = kSlots0 + (kLevels - 1) * kSlots;
+
+    // level层槽位的起始下标/一个槽位的刻度数的log2
+    static int Base(int level) {return level == 0 ? 0 : kSlots0 + (level - 1) * kSlots;}
+    static int Shift(int level) {return level == 0 ? 0 : 8 + (level - 1) * 6;}
+    // level层一圈的刻度数
+    static uint64_t Span(int level) {return 1ull << (level == 0 ? 8 : Shift(level) + 6);}
+
+    // 最早的超时刻度(可能比实际的早) / 它在第0层时为槽位的下标 否则为-1
+    uint64_t nextTick(int* slot0) const
+    {
+        // 第0层 -> 从当前刻度开始的一圈 找到的就是准确的刻度
+        uint64_t best = ~0ull;
+        int cur = m_current & (kSlots0 - 1);
+        int i = findSlot(0, cur, kSlots0);
+        if(i < 0)
+        {
+            i = findSlot(0, 0, cur);
+            if(i >= 0)
+            {
+                i += kSlots0;
+            }
+        }
+        if(slot0)
+        {
+            *slot0 = i >= 0 ? i & (kSlots0 - 1) : -1;
+        }
+        if(i >= 0)
+        {
+            best = m_current - cur + i;
+        }
+
+        // 上层 -> 槽位起点作为下界
+        // 当前下标的槽位: m_current正好是它的起点时还没有cascade 否则已经cascade过 其中的timer在一整圈之后
+        for(int level=1;level<kLevels;level++)
+        {
+            int shift = Shift(level);
+            uint64_t base = m_current >> shift;
+            int idx = base & (kSlots - 1);
+            int from = (m_current & ((1ull << shift) - 1)) == 0 ? idx : idx + 1;
+            int j = findSlot(level, from, kSlots);
+            int dist = j - idx;
+            if(j < 0)
+            {
+                j = findSlot(level, 0, from);
+                dist = j + kSlots - idx;
+            }
+            if(j >= 0 && ((base + dist) << shift) <= best)
+            {
+                best = (base + dist) << shift;
+                if(slot0)
+                {
+                    *slot0 = -1;
+                }
+            }
+        }
+        return best;
+    }
+
+    void place(Timer* timer)
+    {
+        uint64_t expire = std::max(FloorMs(timer->m_next), m_current);
+        uint64_t delta = expire - m_current;
+        int level = 0;
+        while(level < kLevels - 1 && delta >= Span(level))
+        {
+            level++;
+        }
+        if(delta >= Span(level))
+        {
+            expire = m_current + Span(level) - 1;
+        }
+        int slot = Base(level) + ((expire >> Shift(level)) & ((level == 0 ? kSlots0 : kSlots) - 1));
+
+        timer->m_slot = slot;
+        timer->m_slotPrev = nullptr;
+        timer->m_slotNext = m_slots[slot];
+        if(m_slots[slot])
+        {
+            m_slots[slot]->m_slotPrev = timer;
+        }
+        m_slots[slot] = timer;
+        m_bitmap[slot / 64] |= 1ull << (slot % 64);
+    }
+
+    void unlink(Timer* timer)
+    {
+        int slot = timer->m_slot;
+        if(timer->m_slotPrev)
+        {
+            timer->m_slotPrev->m_slotNext = timer->m_slotNext;
+        }
+        else
+        {
+            m_slots[slot] = timer->m_slotNext;
+        }
+        if(timer->m_slotNext)
+        {
+            timer->m_slotNext->m_slotPrev = timer->m_slotPrev;
+        }
+        if(!m_slots[slot])
+        {
+            m_bitmap[slot / 64] &= ~(1ull << (slot % 64));
+        }
+        timer->m_slotPrev = timer->m_slotNext = nullptr;
+        timer->m_slot = -1;
+    }
+
+    // 刻度t为第0层一圈的起点 -> 从高到低把到达起点的上层槽位放回下层
+    void cascade(uint64_t t)
+    {
+        for(int level=kLevels-1;level>=1;level--)
+        {
+            int shift = Shift(level);
+            if((t & ((1ull << shift) - 1)) != 0)
+            {
+                continue;
+            }
+            int slot = Base(level) + ((t >> shift) & (kSlots - 1));
+            Timer* timer = m_slots[slot];
+            m_slots[slot] = nullptr;
+            m_bitmap[slot / 64] &= ~(1ull << (slot % 64));
+            while(timer)
+            {
+                Timer* next = timer->m_slotNext;
+                place(timer);
+                timer = next;
+            }
+        }
+    }
+
+    // level层[from, to)中第一个非空槽位的下标 -> 没有时返回-1
+    int findSlot(int level, int from, int to) const
+    {
+        int base = Base(level);
+        for(int i=base+from;i<base+to;)
+        {
+            uint64_t word = m_bitmap[i / 64] >> (i % 64);
+            if(word)
+            {
+                int found = i + __builtin_ctzll(word);
+                return found < base + to ? found - base : -1;
+            }
+            i = (i / 64 + 1) * 64;
+        }
+        return -1;
+    }
+
+    void takeAll(std::vector<std::shared_ptr<Timer>>& timers)
+    {
+        for(int slot=0;slot<kSlotCount;slot++)
+        {
+            while(Timer* timer = m_slots[slot])
+            {
+                timers.push_back(std::move(timer->m_self));
+                unlink(timer);
+            }
+        }
+        m_size = 0;
+    }
+
+private:
+    Timer* m_slots[kSlotCount];
+    uint64_t m_bitmap[kSlotCount / 64];
+    // 当前刻度(ms) -> 之前的刻度都已经处理过 当前刻度中可能还有这一毫秒内稍后超时的timer
+    uint64_t m_current;
+    size_t m_size = 0;
+};
+
+// 分片 -> 线程加入/取消自己的timer只竞争自己分片的锁 超时处理跳过没有超时timer的分片
+struct alignas(64) TimerManager::Shard
+{
+    std::mutex mutex;
+    // 时间堆
+    std::unique_ptr<TimerQueue> timers;
+    // 最早超时时间的下界(steady_clock纳秒 没有timer时为~0) -> 不加锁读取
+    std::atomic<uint64_t> next{~0ull};
+    // 其他线程取消的timer(无锁链表) -> 持有mutex时再从时间堆中删除
+    std::atomic<Timer*> cancelled{nullptr};
+
+    // 需要持有mutex
+    void drain()
+    {
+        Timer* timer = cancelled.exchange(nullptr, std::memory_order_acquire);
+        while(timer)
+        {
+            Timer* next = timer->m_cancelNext;
+            std::shared_ptr<Timer> self = std::move(timer->m_cancelRef);
+            timer->m_cancelNext = nullptr;
+            timer->m_cb = nullptr;
+            timer->m_recurringCb.reset();
+            timers->erase(timer);
+            timer = next;
+        }
+        if(timers->empty())
+        {
+            this->next.store(~0ull);
+        }
+    }
+};
+
+bool Timer::cancel() 
+{
+    TimerManager::Shard& shard = *m_manager->m_shards[m_shard];
+    if(m_manager->localShard() != m_shard)
+    {
+        // 其他线程的timer -> 不加锁 放入它所在分片的无锁链表
+        int expected = ARMED;
+        if(!m_state.compare_exchange_strong(expected, CANCELLED))
+        {
+            return false;
+        }
+        m_cancelRef = shared_from_this();
+        Timer* head = shard.cancelled.load(std::memory_order_relaxed);
+        do
+        {
+            m_cancelNext = head;
+        }
+        while(!shard.cancelled.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    int expected = ARMED;
+    if(!m_state.compare_exchange_strong(expected, CANCELLED))
     {
-        m_cb = nullptr;
+        return false;
     }
+    m_cb = nullptr;
+    m_recurringCb.reset();
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it!=m_manager->m_timers.end())
+    // 从堆中删除时可能释放最后一个引用
+    std::shared_ptr<Timer> self = shared_from_this();
+    shard.timers->erase(this);
+    if(shard.timers->empty())
     {
-        m_manager->m_timers.erase(it);
+        shard.next.store(~0ull);
     }
     return true;
 }
@@ -26,197 +421,349 @@ bool Timer::cancel()
 // refresh 只会向后调整
 bool Timer::refresh() 
 {
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
+    TimerManager::Shard& shard = *m_manager->m_shards[m_shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-    if(!m_cb) 
+    if(!isActive()) 
     {
         return false;
     }
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it==m_manager->m_timers.end())
+    std::shared_ptr<Timer> self = shared_from_this();
+    if(!shard.timers->erase(this))
     {
         return false;
     }
 
-    m_manager->m_timers.erase(it);
-    m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms);
-    m_manager->m_timers.insert(shared_from_this());
+    // 只会向后调整 -> 分片的最早超时时间仍然是下界
+    arm(std::chrono::steady_clock::now() + m_timeout);
+    shard.timers->insert(self);
     return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) 
 {
-    if(ms==m_ms && !from_now)
+    std::chrono::nanoseconds timeout = std::chrono::milliseconds(ms);
+    if(timeout==m_timeout && !from_now)
     {
         return true;
     }
 
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
+        TimerManager::Shard& shard = *m_manager->m_shards[m_shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
     
-        if(!m_cb) 
+        if(!isActive()) 
         {
             return false;
         }
         
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if(it==m_manager->m_timers.end())
+        if(!shard.timers->erase(this))
         {
             return false;
-        }   
-        m_manager->m_timers.erase(it); 
+        }
     }
 
     // reinsert
-    auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms);
-    m_ms = ms;
-    m_next = start + std::chrono::milliseconds(m_ms);
+    auto start = from_now ? std::chrono::steady_clock::now() : m_next - m_delay - m_timeout;
+    m_timeout = timeout;
+    arm(start + m_timeout);
     m_manager->addTimer(shared_from_this()); // insert with lock
     return true;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager):
-m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) 
+Timer::Timer(std::chrono::nanoseconds timeout, Callback cb, bool recurring, std::chrono::nanoseconds slack, TimerManager* manager):
+m_recurring(recurring), m_timeout(timeout), m_slack(slack), m_manager(manager) 
+{
+    if(m_recurring)
+    {
+        m_recurringCb = std::make_shared<Callback>(std::move(cb));
+    }
+    else
+    {
+        m_cb = std::move(cb);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    arm(now + m_timeout);
+}
+
+void Timer::arm(std::chrono::time_point<std::chrono::steady_clock> next)
+{
+    m_next = next;
+    m_delay = std::chrono::nanoseconds(0);
+    if(m_slack.count() <= 0)
+    {
+        return;
+    }
+
+    // 取整的粒度为不超过slack的2的幂 -> 不同slack的timer也落在同一组时间点上
+    uint64_t grain = 1ull << (63 - __builtin_clzll(m_slack.count()));
+    uint64_t ns = ToNs(next);
+    uint64_t rounded = (ns + grain - 1) & ~(grain - 1);
+    m_delay = std::chrono::nanoseconds(rounded - ns);
+    m_next = next + m_delay;
+}
+
+std::chrono::time_point<std::chrono::steady_clock> Timer::nextRecurrence(std::chrono::time_point<std::chrono::steady_clock> now) const
 {
-    auto now = std::chrono::system_clock::now();
-    m_next = now + std::chrono::milliseconds(m_ms);
+    if(m_recurrence == FIXED_DELAY || m_timeout.count() <= 0)
+    {
+        return now + m_timeout;
+    }
+
+    // 从请求的超时时间开始 -> slack的取整不会累积
+    auto next = m_next - m_delay + m_timeout;
+    if(next > now)
+    {
+        return next;
+    }
+
+    // 错过了周期
+    switch(m_recurrence)
+    {
+    case FIXED_RATE_SKIP:
+        return next + ((now - next) / m_timeout + 1) * m_timeout;
+    case FIXED_RATE_COALESCE:
+        return now + m_timeout;
+    default:
+        return next;
+    }
 }
 
 bool Timer::Comparator::operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const
 {
     assert(lhs!=nullptr&&rhs!=nullptr);
-    return lhs->m_next < rhs->m_next;
+    if(lhs->m_next != rhs->m_next)
+    {
+        return lhs->m_next < rhs->m_next;
+    }
+    return lhs.get() < rhs.get();
 }
 
-TimerManager::TimerManager() 
+TimerManager::TimerManager(Backend backend, size_t shards) 
 {
-    m_previouseTime = std::chrono::system_clock::now();
+    assert(shards > 0);
+    for(size_t i=0;i<shards;i++)
+    {
+        m_shards.emplace_back(new Shard());
+        if(backend == SET)
+        {
+            m_shards.back()->timers.reset(new TimerSet());
+        }
+        else
+        {
+            m_shards.back()->timers.reset(new TimerWheel(std::chrono::steady_clock::now()));
+        }
+    }
 }
 
 TimerManager::~TimerManager() 
 {
+    for(auto& shard : m_shards)
+    {
+        shard->drain();
+    }
 }
 
-std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) 
+std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, Callback cb, bool recurring) 
 {
-    std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
-    addTimer(timer);
-    return timer;
+    return addTimer(std::chrono::milliseconds(ms), std::move(cb), recurring);
 }
 
-// 如果条件存在 -> 执行cb()
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
+std::shared_ptr<Timer> TimerManager::addTimer(std::chrono::nanoseconds timeout, Callback cb, bool recurring, std::chrono::nanoseconds slack) 
 {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp)
-    {
-        cb();
-    }
+    return createTimer(timeout, std::move(cb), recurring, Timer::FIXED_DELAY, slack);
 }
 
-std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) 
+std::shared_ptr<Timer> TimerManager::addRecurringTimer(std::chrono::nanoseconds period, Callback cb, Timer::Recurrence recurrence, std::chrono::nanoseconds slack) 
 {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    return createTimer(period, std::move(cb), true, recurrence, slack);
 }
 
-uint64_t TimerManager::getNextTimer()
+std::shared_ptr<Timer> TimerManager::createTimer(std::chrono::nanoseconds timeout, Callback cb, bool recurring, Timer::Recurrence recurrence, std::chrono::nanoseconds slack) 
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    
-    // reset m_tickled
-    m_tickled = false;
-    
-    if (m_timers.empty())
+    if(slack.count() < 0)
     {
-        // 返回最大值
-        return ~0ull;
+        slack = getDefaultSlack();
     }
+    std::shared_ptr<Timer> timer(new Timer(timeout, std::move(cb), recurring, slack, this));
+    timer->m_recurrence = recurrence;
+    timer->m_shard = localShard();
+    addTimer(timer);
+    return timer;
+}
 
-    auto now = std::chrono::system_clock::now();
-    auto time = (*m_timers.begin())->m_next;
+uint64_t TimerManager::getNextTimer()
+{
+    uint64_t ns = getNextTimerNs();
+    return ns == ~0ull ? ns : (ns + 999999) / 1000000;
+}
+
+uint64_t TimerManager::getNextTimerNs()
+{
+    auto earliest = [this]()
+    {
+        uint64_t next = ~0ull;
+        for(auto& shard : m_shards)
+        {
+            next = std::min(next, shard->next.load());
+        }
+        return next;
+    };
 
-    if(now>=time)
+    // 先公布等待的时间再检查一次分片 -> 与addTimer()中先更新分片再读m_earliest配对
+    // 要么这里看到新加入的timer 要么addTimer()看到m_earliest并唤醒等待者
+    uint64_t next = earliest();
+    m_earliest.store(next);
+    uint64_t again = earliest();
+    if(again < next)
     {
-        // 已经有timer超时
-        return 0;
+        next = again;
+        m_earliest.store(next);
     }
-    else
+
+    if (next == ~0ull)
     {
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(time - now);
-        return static_cast<uint64_t>(duration.count());            
-    }  
+        // 返回最大值
+        return ~0ull;
+    }
+
+    uint64_t now = ToNs(std::chrono::steady_clock::now());
+    // 已经有timer超时 -> 0
+    return next > now ? next - now : 0;
 }
 
-void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs)
+void TimerManager::listExpiredCb(std::vector<Callback>& cbs)
 {
-    auto now = std::chrono::system_clock::now();
-
-    std::unique_lock<std::shared_mutex> write_lock(m_mutex); 
-
-    bool rollover = detectClockRollover();
-    
-    // 回退 -> 清理所有timer || 超时 -> 清理超时timer
-    while (!m_timers.empty() && rollover || !m_timers.empty() && (*m_timers.begin())->m_next <= now)
+    auto now = std::chrono::steady_clock::now();
+    uint64_t now_ns = ToNs(now);
+    std::vector<std::shared_ptr<Timer>> expired;
+    // 因为slack推迟的timer的请求超时时间 -> 没有slack时每个不同的值都需要醒来一次
+    std::vector<uint64_t> requested;
+    // 有没有推迟的timer触发 -> 这次醒来本来就需要
+    bool exact = false;
+    auto record = [&](const Timer& timer)
     {
-        std::shared_ptr<Timer> temp = *m_timers.begin();
-        m_timers.erase(m_timers.begin());
-        
-        cbs.push_back(temp->m_cb); 
-
-        if (temp->m_recurring)
+        if(timer.m_delay.count() > 0)
         {
-            // 重新加入时间堆
-            temp->m_next = now + std::chrono::milliseconds(temp->m_ms);
-            m_timers.insert(temp);
+            requested.push_back(ToNs(timer.m_next - timer.m_delay));
         }
         else
         {
-            // 清理cb
-            temp->m_cb = nullptr;
+            exact = true;
+        }
+    };
+
+    for(auto& s : m_shards)
+    {
+        Shard& shard = *s;
+        if(shard.next.load() > now_ns && !shard.cancelled.load(std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.drain();
+
+        // 超时 -> 清理超时timer
+        shard.timers->popExpired(now, expired);
+        for(auto& temp : expired)
+        {
+            if (temp->m_recurring)
+            {
+                // 已经被其他线程取消 -> 等待drain()
+                if(!temp->isActive())
+                {
+                    continue;
+                }
+                // 交出回调后 执行前被取消的 -> 不再执行 cancel()返回true之后不会再触发
+                cbs.push_back([cb = temp->m_recurringCb, timer = temp]()
+                {
+                    if(timer->isActive())
+                    {
+                        (*cb)();
+                    }
+                });
+                record(*temp);
+                // 重新加入时间堆
+                temp->arm(temp->nextRecurrence(now));
+                shard.timers->insert(temp);
+            }
+            else
+            {
+                int expected = Timer::ARMED;
+                if(temp->m_state.compare_exchange_strong(expected, Timer::FIRED))
+                {
+                    // 交出cb
+                    cbs.push_back(std::move(temp->m_cb));
+                    temp->m_cb = nullptr;
+                    record(*temp);
+                }
+            }
         }
+        expired.clear();
+        // 上面检查之后被其他线程取消的循环timer已经重新加入 -> 释放锁之前删除
+        shard.drain();
+        shard.next.store(shard.timers->empty() ? ~0ull : ToNs(shard.timers->next()));
+    }
+
+    if(!requested.empty())
+    {
+        std::sort(requested.begin(), requested.end());
+        size_t distinct = std::unique(requested.begin(), requested.end()) - requested.begin();
+        m_avoidedWakeups += exact ? distinct : distinct - 1;
     }
 }
 
 bool TimerManager::hasTimer() 
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    return !m_timers.empty();
+    bool has = false;
+    for(auto& shard : m_shards)
+    {
+        // 只剩下被其他线程取消的timer时也算作没有
+        if(shard->cancelled.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->drain();
+        }
+        has = has || shard->next.load() != ~0ull;
+    }
+    return has;
 }
 
 // lock + tickle()
 void TimerManager::addTimer(std::shared_ptr<Timer> timer)
 {
-    bool at_front = false;
+    Shard& shard = *m_shards[timer->m_shard];
+    uint64_t next = ToNs(timer->m_next);
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-        auto it = m_timers.insert(timer).first;
-        at_front = (it == m_timers.begin()) && !m_tickled;
-        
-        // only tickle once till one thread wakes up and runs getNextTime()
-        if(at_front)
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.drain();
+        shard.timers->insert(timer);
+        if(next < shard.next.load(std::memory_order_relaxed))
         {
-            m_tickled = true;
+            shard.next.store(next);
         }
     }
-   
-    if(at_front)
+
+    // 比等待者正在等待的时间早 -> 把m_earliest改小的线程唤醒它 只唤醒一次
+    uint64_t earliest = m_earliest.load();
+    while(next < earliest)
     {
-        // wake up 
-        onTimerInsertedAtFront();
+        if(m_earliest.compare_exchange_weak(earliest, next))
+        {
+            // wake up 
+            onTimerInsertedAtFront();
+            break;
+        }
     }
 }
 
-bool TimerManager::detectClockRollover() 
+size_t TimerManager::localShard()
 {
-    bool rollover = false;
-    auto now = std::chrono::system_clock::now();
-    if(now < (m_previouseTime - std::chrono::milliseconds(60 * 60 * 1000))) 
-    {
-        rollover = true;
-    }
-    m_previouseTime = now;
-    return rollover;
+    size_t shard = getShard();
+    return shard < m_shards.size() ? shard : 0;
 }
 
 }
@@ -8,15 +8,38 @@
 #include <assert.h>
 #include <functional>
 #include <mutex>
+#include <chrono>
+#include <atomic>
+
+#include "unique_function.h"
 
 namespace sylar {
 
 class TimerManager;
+class TimerQueue;
+class TimerSet;
+class TimerWheel;
 
 class Timer : public std::enable_shared_from_this<Timer> 
 {
     friend class TimerManager;
+    friend class TimerSet;
+    friend class TimerWheel;
 public:
+    // 循环timer的触发方式
+    enum Recurrence
+    {
+        // 上次处理超时后再等一个周期 -> 分发延迟会累积到间隔中
+        FIXED_DELAY,
+        // 以下从上次的超时时间开始加一个周期 -> 不累积延迟 区别在于错过周期(超时时已经过了下一个超时时间)时:
+        // 只触发一次 跳过错过的周期 下次超时时间仍在原来的网格上
+        FIXED_RATE_SKIP,
+        // 只触发一次 从现在开始重新计算网格
+        FIXED_RATE_COALESCE,
+        // 每个错过的周期都补发 -> 每次处理超时触发一次 直到追上
+        FIXED_RATE_BURST
+    };
+
     // 从时间堆中删除timer
     bool cancel();
     // 刷新timer
@@ -25,22 +48,59 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+    Timer(std::chrono::nanoseconds timeout, Callback cb, bool recurring, std::chrono::nanoseconds slack, TimerManager* manager);
+
+    // 设置绝对超时时间 -> 按m_slack向后取整
+    void arm(std::chrono::time_point<std::chrono::steady_clock> next);
+    // 循环timer在now超时后的下一个超时时间 -> 按m_recurrence计算
+    std::chrono::time_point<std::chrono::steady_clock> nextRecurrence(std::chrono::time_point<std::chrono::steady_clock> now) const;
+
+    // 是否还未被取消/触发
+    bool isActive() const {return m_state.load(std::memory_order_acquire) == ARMED;}
  
 private:
+    enum State
+    {
+        // 等待超时(循环timer触发后仍为此状态)
+        ARMED,
+        FIRED,
+        CANCELLED
+    };
+
     // 是否循环
     bool m_recurring = false;
+    Recurrence m_recurrence = FIXED_DELAY;
     // 超时时间
-    uint64_t m_ms = 0;
-    // 绝对超时时间
-    std::chrono::time_point<std::chrono::system_clock> m_next;
+    std::chrono::nanoseconds m_timeout{0};
+    // 绝对超时时间 -> 单调时钟 不受系统时间调整的影响
+    std::chrono::time_point<std::chrono::steady_clock> m_next;
+    // 允许推迟的时间(类似Linux的timer slack) -> 超时时间向后取整到不超过它的2的幂纳秒 同一区间内的timer一起触发
+    std::chrono::nanoseconds m_slack{0};
+    // 取整推迟的时间 -> m_next - m_delay为请求的超时时间
+    std::chrono::nanoseconds m_delay{0};
     // 超时时触发的回调函数
-    std::function<void()> m_cb;
+    Callback m_cb;
+    // 循环timer的回调函数 -> 每次超时交出一个共享它的调用对象 而不是拷贝
+    std::shared_ptr<Callback> m_recurringCb;
     // 管理此timer的管理器
     TimerManager* m_manager = nullptr;
+    // 所在的分片 -> 创建时所在线程的分片 之后不变
+    size_t m_shard = 0;
+    // 取消和触发通过CAS竞争 -> 其他线程取消时不需要加锁
+    std::atomic<int> m_state{ARMED};
+    // 其他线程取消时放入分片的无锁链表 -> 持有自身的引用直到分片处理它
+    Timer* m_cancelNext = nullptr;
+    std::shared_ptr<Timer> m_cancelRef;
+
+    // 时间轮 -> 所在槽位的双向链表 / 槽位的下标(-1表示不在时间轮中)
+    Timer* m_slotPrev = nullptr;
+    Timer* m_slotNext = nullptr;
+    int m_slot = -1;
+    // 在时间轮中时持有自身的引用 -> 与std::set中的shared_ptr相同 保证触发前不被析构
+    std::shared_ptr<Timer> m_self;
 
 private:
-    // 实现最小堆的比较函数
+    // 实现最小堆的比较函数 -> 超时时间相同时按地址区分 否则std::set会把它们当作同一个timer
     struct Comparator 
     {
         bool operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const;
@@ -51,43 +111,87 @@ class TimerManager
 {
     friend class Timer;
 public:
-    TimerManager();
+    // 保存timer的数据结构
+    enum Backend
+    {
+        // 按超时时间排序的std::set -> 添加/删除O(log n) 每个timer一次树节点分配
+        SET,
+        // 分层时间轮(毫秒精度) -> 添加/删除O(1) 不需要额外分配
+        WHEEL
+    };
+
+    // shards -> 分片数 每个分片有自己的锁和时间堆 见getShard()
+    explicit TimerManager(Backend backend = WHEEL, size_t shards = 1);
     virtual ~TimerManager();
 
     // 添加timer
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
-
-    // 添加条件timer
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
-
-    // 拿到堆中最近的超时时间
+    std::shared_ptr<Timer> addTimer(uint64_t ms, Callback cb, bool recurring = false);
+    // 添加timer -> 纳秒精度 slack为允许推迟的时间(为负时使用getDefaultSlack())
+    // recurring为true时按FIXED_DELAY循环(与之前相同) -> 按固定频率循环使用addRecurringTimer()
+    std::shared_ptr<Timer> addTimer(std::chrono::nanoseconds timeout, Callback cb, bool recurring = false, 
+                                    std::chrono::nanoseconds slack = std::chrono::nanoseconds(-1));
+    // 添加循环timer -> 按recurrence计算每次的超时时间
+    std::shared_ptr<Timer> addRecurringTimer(std::chrono::nanoseconds period, Callback cb, Timer::Recurrence recurrence = Timer::FIXED_RATE_SKIP, 
+                                             std::chrono::nanoseconds slack = std::chrono::nanoseconds(-1));
+
+    // 添加条件timer -> 超时时条件仍然存在才执行cb()
+    // 模板 -> 包装后的lambda仍能放进Callback的内联存储
+    template<class F>
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, F cb, std::weak_ptr<void> weak_cond, bool recurring = false)
+    {
+        return addTimer(ms, [weak_cond, cb = std::move(cb)]()
+        {
+            std::shared_ptr<void> tmp = weak_cond.lock();
+            if(tmp)
+            {
+                cb();
+            }
+        }, recurring);
+    }
+
+    // 拿到所有分片中最近的超时时间(毫秒 向上取整 -> 等待这么久不会早于timer醒来)
+    // 调用者随后等待这么久 -> 在此之前加入更早的timer时会触发onTimerInsertedAtFront()
     uint64_t getNextTimer();
+    // 同上 纳秒
+    uint64_t getNextTimerNs();
 
-    // 取出所有超时定时器的回调函数
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    // 取出所有分片中超时定时器的回调函数 -> 没有超时timer的分片不加锁
+    void listExpiredCb(std::vector<Callback>& cbs);
 
     // 堆中是否有timer
     bool hasTimer();
 
+    // 没有指定slack的timer允许推迟的时间 -> 默认为0(不推迟)
+    void setDefaultSlack(std::chrono::nanoseconds slack) {m_defaultSlack = slack.count();}
+    std::chrono::nanoseconds getDefaultSlack() const {return std::chrono::nanoseconds(m_defaultSlack.load());}
+
+    // 因为slack合并而少醒来的次数(上界) -> 每次listExpiredCb()中被推迟的timer的不同请求超时时间数 没有未推迟的timer触发时再减1
+    uint64_t getAvoidedWakeups() const {return m_avoidedWakeups;}
+
 protected:
     // 当一个最早的timer加入到堆中 -> 调用该函数
     virtual void onTimerInsertedAtFront() {};
 
+    // 当前线程的分片 -> 线程加入/取消自己的timer只竞争自己分片的锁 超出分片数时使用分片0
+    virtual size_t getShard() {return 0;}
+
     // 添加timer
     void addTimer(std::shared_ptr<Timer> timer);
 
 private:
-    // 当系统时间改变时 -> 调用该函数
-    bool detectClockRollover();
+    struct Shard;
+
+    // 当前线程的分片下标
+    size_t localShard();
+
+    std::shared_ptr<Timer> createTimer(std::chrono::nanoseconds timeout, Callback cb, bool recurring, Timer::Recurrence recurrence, std::chrono::nanoseconds slack);
 
 private:
-    std::shared_mutex m_mutex;
-    // 时间堆
-    std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;
-    // 在下次getNextTime()执行前 onTimerInsertedAtFront()是否已经被触发了 -> 在此过程中 onTimerInsertedAtFront()只执行一次
-    bool m_tickled = false;
-    // 上次检查系统时间是否回退的绝对时间
-    std::chrono::time_point<std::chrono::system_clock> m_previouseTime;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    // 等待者正在等待的超时时间(steady_clock纳秒) -> 加入的timer比它早时由把它改小的线程触发onTimerInsertedAtFront() 只触发一次
+    std::atomic<uint64_t> m_earliest{~0ull};
+    std::atomic<int64_t> m_defaultSlack{0};
+    std::atomic<uint64_t> m_avoidedWakeups{0};
 };
 
 }
@@ -0,0 +1,234 @@
+#ifndef _UNIQUE_FUNCTION_H_
+#define _UNIQUE_FUNCTION_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar {
+
+// 回调函数内联存储的大小
+// 默认48字节 -> 能放下do_io/sleep中捕获weak_ptr/协程指针和若干指针的lambda
+#ifndef SYLAR_CALLBACK_INLINE_SIZE
+#define SYLAR_CALLBACK_INLINE_SIZE 48
+#endif
+
+template<class Sig, size_t Capacity = SYLAR_CALLBACK_INLINE_SIZE>
+class unique_function;
+
+// 只能移动的可调用对象包装
+// 与std::function相比:
+// 1 不要求可拷贝 -> 可以捕获unique_ptr等只能移动的对象
+// 2 内联存储的容量可配置 -> 不超过Capacity且可无异常移动的对象不会分配堆内存
+template<class R, class... Args, size_t Capacity>
+class unique_function<R(Args...), Capacity>
+{
+private:
+	// 类型擦除后的操作
+	struct VTable
+	{
+		R (*invoke)(void* storage, Args&&... args);
+		// 把src中的对象移动到dst 并析构src中的对象
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* storage);
+	};
+
+	template<class F>
+	static constexpr bool IsInline()
+	{
+		return sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t)
+			&& std::is_nothrow_move_constructible<F>::value;
+	}
+
+	// 内联存储
+	template<class F>
+	struct InlineOps
+	{
+		static R invoke(void* storage, Args&&... args)
+		{
+			return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+		}
+
+		static void move(void* dst, void* src)
+		{
+			F* f = static_cast<F*>(src);
+			new (dst) F(std::move(*f));
+			f->~F();
+		}
+
+		static void destroy(void* storage)
+		{
+			static_cast<F*>(storage)->~F();
+		}
+
+		static const VTable* vtable()
+		{
+			static const VTable s_vtable = {&invoke, &move, &destroy};
+			return &s_vtable;
+		}
+	};
+
+	// 堆存储 -> storage中只保存指针
+	template<class F>
+	struct HeapOps
+	{
+		static R invoke(void* storage, Args&&... args)
+		{
+			return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+		}
+
+		static void move(void* dst, void* src)
+		{
+			*static_cast<F**>(dst) = *static_cast<F**>(src);
+		}
+
+		static void destroy(void* storage)
+		{
+			delete *static_cast<F**>(storage);
+		}
+
+		static const VTable* vtable()
+		{
+			static const VTable s_vtable = {&invoke, &move, &destroy};
+			return &s_vtable;
+		}
+	};
+
+	template<class Fn>
+	static bool IsEmpty(const Fn& f)
+	{
+		if constexpr (std::is_pointer<Fn>::value || std::is_member_pointer<Fn>::value)
+		{
+			return f == nullptr;
+		}
+		else if constexpr (std::is_class<Fn>::value && std::is_constructible<bool, const Fn&>::value)
+		{
+			return !static_cast<bool>(f);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	template<class F>
+	using EnableIfCallable = typename std::enable_if<
+		!std::is_same<typename std::decay<F>::type, unique_function>::value &&
+		std::is_invocable_r<R, typename std::decay<F>::type&, Args...>::value>::type;
+
+public:
+	unique_function() {}
+	unique_function(std::nullptr_t) {}
+
+	template<class F, class = EnableIfCallable<F>>
+	unique_function(F&& f)
+	{
+		typedef typename std::decay<F>::type Fn;
+		// 空的函数指针/std::function -> 视为空
+		if(IsEmpty<Fn>(f))
+		{
+			return;
+		}
+
+		if constexpr (IsInline<Fn>())
+		{
+			new (&m_storage) Fn(std::forward<F>(f));
+			m_vtable = InlineOps<Fn>::vtable();
+		}
+		else
+		{
+			*reinterpret_cast<Fn**>(&m_storage) = new Fn(std::forward<F>(f));
+			m_vtable = HeapOps<Fn>::vtable();
+		}
+	}
+
+	unique_function(unique_function&& other) noexcept
+	{
+		moveFrom(other);
+	}
+
+	unique_function& operator=(unique_function&& other) noexcept
+	{
+		if(this != &other)
+		{
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	unique_function& operator=(std::nullptr_t)
+	{
+		reset();
+		return *this;
+	}
+
+	template<class F, class = EnableIfCallable<F>>
+	unique_function& operator=(F&& f)
+	{
+		unique_function(std::forward<F>(f)).swap(*this);
+		return *this;
+	}
+
+	unique_function(const unique_function&) = delete;
+	unique_function& operator=(const unique_function&) = delete;
+
+	~unique_function()
+	{
+		reset();
+	}
+
+	R operator()(Args... args) const
+	{
+		return m_vtable->invoke(const_cast<void*>(static_cast<const void*>(&m_storage)), std::forward<Args>(args)...);
+	}
+
+	explicit operator bool() const {return m_vtable != nullptr;}
+
+	// 被包装对象的类型标识 -> 同一个lambda(调用点)的所有实例相同 空时为nullptr
+	const void* target_id() const {return m_vtable;}
+
+	void swap(unique_function& other) noexcept
+	{
+		unique_function tmp(std::move(other));
+		other = std::move(*this);
+		*this = std::move(tmp);
+	}
+
+	void reset()
+	{
+		if(m_vtable)
+		{
+			m_vtable->destroy(&m_storage);
+			m_vtable = nullptr;
+		}
+	}
+
+private:
+	void moveFrom(unique_function& other)
+	{
+		if(other.m_vtable)
+		{
+			other.m_vtable->move(&m_storage, &other.m_storage);
+			m_vtable = other.m_vtable;
+			other.m_vtable = nullptr;
+		}
+	}
+
+private:
+	typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type m_storage;
+	const VTable* m_vtable = nullptr;
+};
+
+template<class Sig, size_t Capacity>
+bool operator==(const unique_function<Sig, Capacity>& f, std::nullptr_t) {return !f;}
+template<class Sig, size_t Capacity>
+bool operator!=(const unique_function<Sig, Capacity>& f, std::nullptr_t) {return (bool)f;}
+
+// 调度器/定时器/IOManager中使用的回调类型
+typedef unique_function<void()> Callback;
+
+}
+
+#endif
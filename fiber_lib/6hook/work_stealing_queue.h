@@ -0,0 +1,152 @@
+#ifndef _WORK_STEALING_QUEUE_H_
+#define _WORK_STEALING_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <type_traits>
+
+namespace sylar {
+
+// Chase-Lev工作窃取双端队列(内存序参考 Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models")
+// 只有所属线程可以push()/pop() -> 在底部操作 后进先出 只在剩最后一个元素时才需要CAS
+// 其他线程通过steal()从顶部窃取 -> 先进先出
+// 环形数组满了之后按2倍扩容 -> 旧数组可能仍被窃取者读取 -> 保留到队列析构时才释放
+// 环形数组在第一次push()时才分配 -> 由所属线程分配 按首次访问落在它的NUMA节点上
+// T需要可平凡拷贝(一般为指针)
+template<class T>
+class WorkStealingQueue
+{
+	static_assert(std::is_trivially_copyable<T>::value, "WorkStealingQueue requires a trivially copyable type");
+
+private:
+	struct Array
+	{
+		int64_t capacity;
+		int64_t mask;
+		std::atomic<T>* buffer;
+
+		explicit Array(int64_t cap): capacity(cap), mask(cap - 1), buffer(new std::atomic<T>[cap]) {}
+		~Array() {delete[] buffer;}
+
+		T get(int64_t i) const {return buffer[i & mask].load(std::memory_order_relaxed);}
+		void put(int64_t i, T x) {buffer[i & mask].store(x, std::memory_order_relaxed);}
+
+		Array* grow(int64_t bottom, int64_t top) const
+		{
+			Array* a = new Array(capacity * 2);
+			for(int64_t i=top;i<bottom;i++)
+			{
+				a->put(i, get(i));
+			}
+			return a;
+		}
+	};
+
+public:
+	// capacity需要是2的幂
+	explicit WorkStealingQueue(int64_t capacity = 256): m_capacity(capacity)
+	{
+	}
+
+	~WorkStealingQueue()
+	{
+		for(Array* a : m_garbage)
+		{
+			delete a;
+		}
+		delete m_array.load(std::memory_order_relaxed);
+	}
+
+	WorkStealingQueue(const WorkStealingQueue&) = delete;
+	WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+	// 所属线程: 放入底部
+	void push(T x)
+	{
+		int64_t b = m_bottom.load(std::memory_order_relaxed);
+		int64_t t = m_top.load(std::memory_order_acquire);
+		Array* a = m_array.load(std::memory_order_relaxed);
+		if(!a)
+		{
+			a = new Array(m_capacity);
+			m_array.store(a, std::memory_order_release);
+		}
+		else if(b - t > a->capacity - 1)
+		{
+			m_garbage.push_back(a);
+			a = a->grow(b, t);
+			m_array.store(a, std::memory_order_release);
+		}
+		a->put(b, x);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	// 所属线程: 从底部取出 -> 队列为空时返回false
+	bool pop(T& x)
+	{
+		int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+		// 队列不为空时一定已经分配
+		Array* a = m_array.load(std::memory_order_relaxed);
+		m_bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = m_top.load(std::memory_order_relaxed);
+
+		if(t > b)
+		{
+			// 空
+			m_bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		x = a->get(b);
+		if(t == b)
+		{
+			// 最后一个元素 -> 与窃取者竞争
+			bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			m_bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	// 任意线程: 从顶部窃取 -> 队列为空或与其他线程竞争失败时返回false
+	bool steal(T& x)
+	{
+		int64_t t = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = m_bottom.load(std::memory_order_acquire);
+		if(t >= b)
+		{
+			return false;
+		}
+
+		Array* a = m_array.load(std::memory_order_acquire);
+		x = a->get(t);
+		return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// 近似值 -> 只用于判断是否为空/统计
+	size_t size() const
+	{
+		int64_t b = m_bottom.load(std::memory_order_relaxed);
+		int64_t t = m_top.load(std::memory_order_relaxed);
+		return b > t ? b - t : 0;
+	}
+
+	bool empty() const {return size() == 0;}
+
+private:
+	// 顶部和底部放在不同的缓存行 -> 所属线程和窃取者不会互相干扰
+	alignas(64) std::atomic<int64_t> m_top{0};
+	alignas(64) std::atomic<int64_t> m_bottom{0};
+	std::atomic<Array*> m_array{nullptr};
+	int64_t m_capacity;
+	// 扩容后被替换的数组 -> 只由所属线程访问
+	std::vector<Array*> m_garbage;
+};
+
+}
+
+#endif